@@ -4,44 +4,93 @@
  * or even algorithm accurate. It should be a somewhat reasonable
  * stand-in, which should allow us to run base-line comparisions with
  * the real device.
+ *
+ * am_tcmd() and am_tstat() give command timing (BUSY) from the data
+ * sheet execution times, against the host tstates.
+ *
+ * Compiled with -DAM_ASYNC (host only, POSIX threads), am_async() lets
+ * a chip hand its slow commands to worker threads (see am_async()).
  */
 
 
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
+#if defined(AM_ASYNC) || defined(AM_POOL)
+#include <pthread.h>
+#endif
+#ifdef AM_ASYNC
+#include <unistd.h>
+#endif
 
 #include "am9511.h"
+#include "amfp.h"
 #include "floatcnv.h"
 #include "ova.h"
 #include "types.h"
 
 
-/* Define fp_na() -- fp to native and
- *        na_fp() -- native to fp
+/* Define am_na() -- AM9511 to native and
+ *        na_am() -- native to AM9511
  */
 #ifdef z80
-#define fp_na(x,y) fp_hi(x,y)
-#define na_fp(x,y) hi_fp(x,y)
+#define am_na(x,y) am_hi(x,y)
+#define na_am(x,y) hi_am(x,y)
 #else
-#define fp_na(x,y) fp_ie(x,y)
-#define na_fp(x,y) ie_fp(x,y)
+#define am_na(x,y) fw_st(y, val_ie(am_val(fw_ld(x)), NULL))
+#define na_am(x,y) fw_st(y, val_am(ie_val(fw_ld(x)), NULL))
 #endif
 
+/* am9511.h spells the _W words out, so as not to need floatcnv.h
+ */
+typedef char am_chk_w[((AM_SMALL_W == FW_AM(0, -65, 0x800000L)) &&
+		       (AM_BIG_W == FW_AM(0, 62, 0xffffffL)) &&
+		       (AM_PI_W == FW_AM(0, 1, 0xc90fdaL))) ? 1 : -1];
+
 /* Stack is 16 bytes long. sp is the stack pointer.
  * Points to next location to use.
  *
+ * The stack is mirrored in stack[16..31], so that an operand of up
+ * to 8 bytes at stpos() is always contiguous, even across the wrap,
+ * and can be loaded in one piece. am_push() writes both copies.
+ * Anything written through stpos() must be copied over with st_fix(),
+ * or written with st_put() in the first place.
+ *
+ * With the libm float commands (not USE_AMFP), fval[k] is the last
+ * float decoded from (or written to) stack[k], and ftag[k] the 4
+ * bytes it came from. If the bytes still match, farg() skips the
+ * conversion.
+ *
+ * SIGN and ZERO are only worked out when the status is read: szp is
+ * the sz function of the last command (or NULL if done), and szb the
+ * top 4 stack bytes when it finished. sz_now() runs it on szb, so
+ * pushes and pops in between do not matter.
+ *
  * AM9511 status and operator latch
  */
 
 struct am_context {
-    unsigned char stack[16];
+    unsigned char stack[32];
     int sp;
-    void *fptmp;
     unsigned char status;
     unsigned char op_latch;
+    void (*szp)(struct am_context *, unsigned char *); /* or NULL */
+    unsigned char szb[4];    /* top of stack for szp */
 #ifndef NDEBUG
     unsigned char last_latch;
+#endif
+    unsigned long done;      /* host tstates when BUSY clears (am_tcmd) */
+    unsigned long tscale;    /* host tstates per chip cycle, x 256 */
+#ifndef USE_AMFP
+    float fval[16];          /* decoded float operand at stack[k] */
+    uint32 ftag[16];         /* stack bytes that gave fval[k] */
+#endif
+#ifdef AM_ASYNC
+    int pend;                /* command with the workers (atomic) */
+    int async;               /* am_async() on */
+    unsigned char aop;       /* the command */
+    struct am_context *next; /* work queue */
 #endif
 };
 
@@ -69,11 +118,58 @@ struct am_context {
 #define dec_sp(n) ctx->sp = sp_add(-(n))
 
 
+/* Wait for a command the workers have (see am_async()). Everything
+ * that touches the chip does this first, except am_status().
+ */
+#ifdef AM_ASYNC
+static void am_wait(struct am_context *ctx);
+
+#define am_sync(ctx) \
+    if (__atomic_load_n(&(ctx)->pend, __ATOMIC_ACQUIRE)) \
+	am_wait(ctx)
+#else
+#define am_sync(ctx)
+#endif
+
+
+/* Update the mirror for n bytes written at stpos(offset). Each
+ * operand written needs its own call, with its own offset -- two
+ * operands may fall either side of the wrap. An operand short of the
+ * wrap is one copy; one across it is copied in two parts.
+ */
+static void st_fix(struct am_context *ctx, int offset, int n) {
+    unsigned char *p;
+    int k;
+
+    k = sp_add(offset);
+    p = ctx->stack + k;
+    if (k + n <= 16) {
+	memcpy(p + 16, p, n);
+    } else {
+	memcpy(p + 16, p, 16 - k);
+	memcpy(ctx->stack, ctx->stack + 16, k + n - 16);
+    }
+}
+
+
+/* Write n bytes from b at stpos(offset), and to the mirror
+ */
+static void st_put(struct am_context *ctx, int offset, void *b, int n) {
+    memcpy(stpos(offset), b, n);
+    st_fix(ctx, offset, n);
+}
+
+
 /* Push byte to am9511 stack
  */
 void am_push(void *amp, unsigned char v) {
     struct am_context *ctx = (struct am_context *)amp;
-    *stpos(0) = v;
+    unsigned char *p;
+
+    am_sync(ctx);
+    p = stpos(0);
+    p[0] = v;
+    p[16] = v;
     inc_sp(1);
 }
 
@@ -82,16 +178,130 @@ void am_push(void *amp, unsigned char v) {
  */
 unsigned char am_pop(void *amp) {
     struct am_context *ctx = (struct am_context *)amp;
+
+    am_sync(ctx);
     dec_sp(1);
     return *stpos(0);
 }
 
 
 
-/* Return status of am9511
+#ifndef z80
+
+/* Bulk push and pop. These push or pop a whole operand in one call:
+ * 16 or 32 bit integer, AM9511 float (4 bytes, in push order) or host
+ * float (converted here). The operand is copied in one piece.
+ *
+ * Host only -- the names are not unique to 5 characters.
+ */
+
+/* Push n bytes, b[0] first
+ */
+static void am_put(struct am_context *ctx, unsigned char *b, int n) {
+    am_sync(ctx);
+    st_put(ctx, 0, b, n);
+    inc_sp(n);
+}
+
+
+/* Pop n bytes, b[0] is the first pushed
+ */
+static void am_get(struct am_context *ctx, unsigned char *b, int n) {
+    am_sync(ctx);
+    dec_sp(n);
+    memcpy(b, stpos(0), n);
+}
+
+
+void am_push16(void *amp, int v) {
+    unsigned char b[2];
+
+    b[0] = v;
+    b[1] = v >> 8;
+    am_put((struct am_context *)amp, b, 2);
+}
+
+void am_push32(void *amp, long v) {
+    unsigned char b[4];
+
+    b[0] = v;
+    b[1] = v >> 8;
+    b[2] = v >> 16;
+    b[3] = v >> 24;
+    am_put((struct am_context *)amp, b, 4);
+}
+
+void am_pushf(void *amp, unsigned char *v) {
+    am_put((struct am_context *)amp, v, 4);
+}
+
+
+/* Push host float. Returns FP_ERR (and pushes 0) if x cannot be
+ * converted to AM9511 format.
+ */
+int am_pushn(void *amp, float x) {
+    struct am_context *ctx = (struct am_context *)amp;
+    unsigned char b[4];
+    int r;
+
+    r = ie_am(&x, b);
+    am_put(ctx, b, 4);
+    return r;
+}
+
+
+int am_pop16(void *amp) {
+    unsigned char b[2];
+
+    am_get((struct am_context *)amp, b, 2);
+    return (int16)(b[0] | (b[1] << 8));
+}
+
+long am_pop32(void *amp) {
+    unsigned char b[4];
+
+    am_get((struct am_context *)amp, b, 4);
+    return (int32)((uint32)b[0] | ((uint32)b[1] << 8) |
+		   ((uint32)b[2] << 16) | ((uint32)b[3] << 24));
+}
+
+void am_popf(void *amp, unsigned char *v) {
+    am_get((struct am_context *)amp, v, 4);
+}
+
+float am_popn(void *amp) {
+    struct am_context *ctx = (struct am_context *)amp;
+    unsigned char b[4];
+    float x;
+
+    am_get(ctx, b, 4);
+    am_ie(b, &x);
+    return x;
+}
+
+#endif
+
+
+/* Set pending SIGN and ZERO
+ */
+#define sz_now() \
+    if (ctx->szp != NULL) { \
+	(*ctx->szp)(ctx, ctx->szb); \
+	ctx->szp = NULL; \
+    }
+
+
+/* Return status of am9511. While the workers have a command, this is
+ * just BUSY (and does not wait).
  */
 unsigned char am_status(void *amp) {
     struct am_context *ctx = (struct am_context *)amp;
+
+#ifdef AM_ASYNC
+    if (__atomic_load_n(&ctx->pend, __ATOMIC_ACQUIRE))
+	return AM_BUSY;
+#endif
+    sz_now();
     return ctx->status;
 }
 
@@ -100,58 +310,102 @@ unsigned char am_status(void *amp) {
 #define IS_FIXED (ctx->op_latch & AM_FIXED)
 
 
-/* Set SIGN and ZERO according to op type and top of stack.
+/* Set SIGN and ZERO according to op type and top of stack (t[3] is
+ * the top byte, t[0] the fourth down).
  * Zero detect for integer is or'ing together all the bytes.
  * Zero detect for float is testing bit 23 for 0.
  * The sign bit for all types is the top-most bit. If 1 then
  * negative.
  */
-static void sz(struct am_context *ctx) {
+static void sz(struct am_context *ctx, unsigned char *t) {
     if (IS_SINGLE) {
-	if ((*stpos(-1) | *stpos(-2)) == 0)
+	if ((t[3] | t[2]) == 0)
 	    ctx->status |= AM_ZERO;
     } else if (IS_FIXED) {
-	if ((*stpos(-1) | *stpos(-2) | *stpos(-3) | *stpos(-4)) == 0)
+	if ((t[3] | t[2] | t[1] | t[0]) == 0)
 	    ctx->status |= AM_ZERO;
     } else {
-	if ((*stpos(-2) & 0x80) == 0)
+	if ((t[2] & 0x80) == 0)
 	    ctx->status |= AM_ZERO;
     }
-    if (*stpos(-1) & 0x80)
+    if (t[3] & 0x80)
+	ctx->status |= AM_SIGN;
+}
+
+
+/* Specialized SIGN and ZERO for SINGLE, DOUBLE and FLOAT results.
+ * The command table selects one of these when it is built, so
+ * handlers do not have to test the op_latch width bits.
+ */
+static void szs(struct am_context *ctx, unsigned char *t) {
+    if ((t[3] | t[2]) == 0)
+	ctx->status |= AM_ZERO;
+    if (t[3] & 0x80)
+	ctx->status |= AM_SIGN;
+}
+
+static void szd(struct am_context *ctx, unsigned char *t) {
+    if ((t[3] | t[2] | t[1] | t[0]) == 0)
+	ctx->status |= AM_ZERO;
+    if (t[3] & 0x80)
+	ctx->status |= AM_SIGN;
+}
+
+static void szf(struct am_context *ctx, unsigned char *t) {
+    if ((t[2] & 0x80) == 0)
+	ctx->status |= AM_ZERO;
+    if (t[3] & 0x80)
 	ctx->status |= AM_SIGN;
 }
 
 
+/* No SIGN and ZERO (NOP, FIXS, FIXD)
+ */
+static void szn(struct am_context *ctx, unsigned char *t) {
+    ctx = ctx;
+    t = t;
+}
+
+
+/* NOP, and unused command 0x1b
+ */
+static void nop(struct am_context *ctx) {
+    ctx = ctx;
+}
+
+
 /* PUPI
  */
 static void pupi(struct am_context *ctx) {
-    am_push(ctx, 0xda); /* little end to big end */
-    am_push(ctx, 0x0f);
-    am_push(ctx, 0xc9);
-    am_push(ctx, 0x02);
-    sz(ctx);
+    am_push(ctx, AM_PI_W & 0xff); /* little end to big end */
+    am_push(ctx, (AM_PI_W >> 8) & 0xff);
+    am_push(ctx, (AM_PI_W >> 16) & 0xff);
+    am_push(ctx, (AM_PI_W >> 24) & 0xff);
 }
 
 
-/* PTOS PTOD PTOF
+/* PTOS
  *
- * This relies on the stack data not moving during a push.
+ * The operand is loaded whole (the mirror makes it contiguous), and
+ * stored whole above it.
  */
-static void pto(struct am_context *ctx) {
-    unsigned char *s; 
+static void ptos(struct am_context *ctx) {
+    uint16 v;
 
-    if (IS_SINGLE) {
-        s = stpos(-2);
-	am_push(ctx, *s++);
-	am_push(ctx, *s);
-    } else {
-        s = stpos(-4);
-        am_push(ctx, *s++);
-	am_push(ctx, *s++);
-	am_push(ctx, *s++);
-	am_push(ctx, *s);
-    }
-    sz(ctx);
+    memcpy(&v, stpos(-2), 2);
+    st_put(ctx, 0, &v, 2);
+    inc_sp(2);
+}
+
+
+/* PTOD PTOF
+ */
+static void ptod(struct am_context *ctx) {
+    uint32 v;
+
+    memcpy(&v, stpos(-4), 4);
+    st_put(ctx, 0, &v, 4);
+    inc_sp(4);
 }
 
 
@@ -162,34 +416,38 @@ static void pto(struct am_context *ctx) {
  * new tos element really is! (in terms of type)
  * The guide states and SIGN and ZERO are affected, but no more than that.
  */
-static void pop(struct am_context *ctx) {
-    if (IS_SINGLE)
-    	dec_sp(2);
-    else
-    	dec_sp(4);
-    sz(ctx);
+static void pops(struct am_context *ctx) {
+    dec_sp(2);
+}
+
+static void popd(struct am_context *ctx) {
+    dec_sp(4);
 }
 
 
-/* XCHS XCHD XCHF
+/* XCHS
+ *
+ * Both operands are loaded whole, and stored back swapped.
  */
-static void xch(struct am_context *ctx) {
-    unsigned char *s, *t, v;
+static void xchs(struct am_context *ctx) {
+    uint16 a, b;
 
-    if (IS_SINGLE) {
-	s = stpos(-2);
-	t = stpos(-4);
-	v = *t; *t++ = *s; *s++ = v;
-	v = *t; *t   = *s; *s   = v;
-    } else {
-	s = stpos(-4);
-	t = stpos(-8);
-	v = *t; *t++ = *s; *s++ = v;
-	v = *t; *t++ = *s; *s++ = v;
-	v = *t; *t++ = *s; *s++ = v;
-	v = *t; *t   = *s; *s   = v;
-    }
-    sz(ctx);
+    memcpy(&a, stpos(-4), 2);
+    memcpy(&b, stpos(-2), 2);
+    st_put(ctx, -4, &b, 2);
+    st_put(ctx, -2, &a, 2);
+}
+
+
+/* XCHD XCHF
+ */
+static void xchd(struct am_context *ctx) {
+    uint32 a, b;
+
+    memcpy(&a, stpos(-8), 4);
+    memcpy(&b, stpos(-4), 4);
+    st_put(ctx, -8, &b, 4);
+    st_put(ctx, -4, &a, 4);
 }
 
 
@@ -200,39 +458,43 @@ static void chsf(struct am_context *ctx) {
      * (if not zero). And, as with the AM9511 chip, CHSF
      * is even faster than CHSS.
      */
-    if (*stpos(-2) & 0x80)
+    if (*stpos(-2) & 0x80) {
         *stpos(-1) ^= 0x80;
-    sz(ctx);
+        st_fix(ctx, -1, 1);
+    }
 }
 
 
-/* CHSS CHSD
+/* CHSS
  */
-static void chs(struct am_context *ctx) {
-    if (IS_SINGLE) {
-        if (cm16(stpos(-2), stpos(-2)))
-	    ctx->status |= AM_ERR_OVF;
-    } else {
-	if (cm32(stpos(-4), stpos(-4)))
-	    ctx->status |= AM_ERR_OVF;
-    }
-    sz(ctx);
+static void chss(struct am_context *ctx) {
+    if (cm16(stpos(-2), stpos(-2)))
+	ctx->status |= AM_ERR_OVF;
+    st_fix(ctx, -2, 2);
+}
+
+
+/* CHSD
+ */
+static void chsd(struct am_context *ctx) {
+    if (cm32(stpos(-4), stpos(-4)))
+	ctx->status |= AM_ERR_OVF;
+    st_fix(ctx, -4, 4);
 }
 
 
-/* Push float to stack, set SIGN and ZERO
+#ifdef z80
+
+/* Push float to stack
  */
 static void push_float(struct am_context *ctx, float x) {
     unsigned char v[4];
 
-    na_fp(&x, ctx->fptmp);
-    fp_am(ctx->fptmp, v);
+    na_am(&x, v);
     am_push(ctx, v[0]);
     am_push(ctx, v[1]);
     am_push(ctx, v[2]);
     am_push(ctx, v[3]);
-    ctx->op_latch = AM_FLOAT;
-    sz(ctx);
 }
 
 
@@ -279,6 +541,10 @@ static void fltd(struct am_context *ctx) {
 
 
 /* FIXS
+ *
+ * The float is truncated, and overflows if that does not fit. On
+ * overflow the float is left in place, and SIGN and ZERO follow the
+ * command width (as sz() does).
  */
 static void fixs(struct am_context *ctx) {
     float x;
@@ -286,20 +552,17 @@ static void fixs(struct am_context *ctx) {
     int n;
 
     s = stpos(-4);
-    am_fp(s, ctx->fptmp);
-    fp_na(ctx->fptmp, &x);
-    if ((x < -32768.0) || (x > 32767.0)) {
+    am_na(s, &x);
+    if ((x <= -32769.0) || (x >= 32768.0)) {
 	ctx->status |= AM_ERR_OVF;
-	sz(ctx);
+	sz(ctx, stpos(-4));
 	return;
     }
     dec_sp(4);
     n = (int)x;
     am_push(ctx, n);
     am_push(ctx, n >> 8);
-    ctx->op_latch = AM_SINGLE;
-    sz(ctx);
-
+    szs(ctx, stpos(-4));
 }
 
 
@@ -309,18 +572,15 @@ static void fixd(struct am_context *ctx) {
     float x;
     unsigned char *s;
     int32 n;
-    float xl, xh;
+    float xl;
 
     s = stpos(-4);
-    am_fp(s, ctx->fptmp);
-    fp_na(ctx->fptmp, &x);
+    am_na(s, &x);
     n = -2147483648;
     xl = (float)n;
-    n = 2147483647;
-    xh = (float)n;
-    if ((x < xl) || (x > xh)) {
+    if ((x < xl) || (x >= -xl)) {
 	ctx->status |= AM_ERR_OVF;
-	sz(ctx);
+	sz(ctx, stpos(-4));
 	return;
     }
     dec_sp(4);
@@ -329,334 +589,755 @@ static void fixd(struct am_context *ctx) {
     am_push(ctx, n >> 8);
     am_push(ctx, n >> 16);
     am_push(ctx, n >> 24);
-    ctx->op_latch = AM_DOUBLE;
-    sz(ctx);
+    szd(ctx, stpos(-4));
 }
 
 
-/* SADD DADD
+#else
+
+/* FLTS FLTD FIXS FIXD on the host work straight on the AM9511 word,
+ * with shifts, and give the same results as the z80 code above (by
+ * way of host float).
  */
-static void add(struct am_context *ctx) {
-    int carry;
-    int overflow;
+#if defined(__GNUC__) || defined(__clang__)
+#define am_clz(m) __builtin_clz(m)
+#else
+static int am_clz(uint32 m) {
+    int n = 0;
 
-    if (IS_SINGLE) {
-        carry    = add16( stpos(-4), stpos(-2), stpos(-4));
-        overflow = oadd16(stpos(-4), stpos(-2), stpos(-4));
-	dec_sp(2);
-    } else {
-        carry    = add32( stpos(-8), stpos(-4), stpos(-8));
-        overflow = oadd32(stpos(-8), stpos(-4), stpos(-8));
-	dec_sp(4);
+    while ((m & 0x80000000UL) == 0) {
+	m <<= 1;
+	++n;
     }
-    if (carry)
-	ctx->status |= AM_CARRY;
-    if (overflow)
-	ctx->status |= AM_ERR_OVF;
-    sz(ctx);
+    return n;
 }
+#endif
 
 
-/* SSUB DSUB
+/* Integer n as an AM9511 word. The magnitude is shifted left by its
+ * leading zeros (so the leading 1 is bit 31), and the top 24 bits are
+ * the mantissa. The 8 bits below are rounded to nearest, ties to even,
+ * as (float)n rounds: 0x80 and up adds 1, but 0x80 only to an odd
+ * mantissa. If that carries out, the mantissa is 0x1000000, and is
+ * shifted down into the exponent.
  */
-static void sub(struct am_context *ctx) {
-    int carry;
-    int overflow;
-
-    if (IS_SINGLE) {
-        carry    = sub16( stpos(-4), stpos(-2), stpos(-4));
-        overflow = osub16(stpos(-4), stpos(-2), stpos(-4));
-	dec_sp(2);
-    } else {
-        carry    = sub32( stpos(-8), stpos(-4), stpos(-8));
-        overflow = osub32(stpos(-8), stpos(-4), stpos(-8));
-	dec_sp(4);
-    }
-    if (carry)
-	ctx->status |= AM_CARRY;
-    if (overflow)
-	ctx->status |= AM_ERR_OVF;
-    sz(ctx);
+static uint32 am_flt(int32 n) {
+    uint32 m, s, c;
+    int z, e;
+
+    if (n == 0)
+	return 0;
+    s = (uint32)n >> 31;
+    m = s ? 0 - (uint32)n : (uint32)n;
+    z = am_clz(m);
+    m <<= z;
+    e = 31 - z;
+    c = m & 0xff;
+    m >>= 8;
+    m += (c + (m & 1) + 0x7f) >> 8;
+    c = m >> 24;
+    m >>= c;
+    e += c;
+    return (s << 31) | ((uint32)((e + 1) & 0x7f) << 24) | m;
 }
 
 
-/* MUL
+/* AM9511 word w truncated to a bits (16 or 32) bit integer, in *np.
+ * Returns 1 (and leaves *np) if that does not fit. With the mantissa
+ * at the top of 32 bits, the integer part is that shifted right by
+ * 31 - exponent (0 for 32 and up: less than 1). 0.0 is 0 whatever its
+ * exponent.
  */
-static void mul(struct am_context *ctx) {
-    int overflow;
+static int am_fix(uint32 w, int bits, int32 *np) {
+    uint32 t, s;
+    int sh;
 
-    if (IS_SINGLE) {
-        overflow = mull16(stpos(-4), stpos(-2), stpos(-4));
-        dec_sp(2);
-    } else {
-        overflow = mull32(stpos(-8), stpos(-4), stpos(-8));
-        dec_sp(4);
+    if ((w & 0x800000) == 0) {
+	*np = 0;
+	return 0;
     }
-    if (overflow)
-	ctx->status |= AM_ERR_OVF;
-    sz(ctx);
+    sh = 31 - (int)FW_AM_E(w);
+    if (sh < 0)
+	return 1;
+    t = (sh < 32) ? ((w << 8) >> sh) : 0;
+    s = w >> 31;
+    if (t > (1UL << (bits - 1)) - 1 + s)
+	return 1;
+    *np = (int32)(s ? 0 - t : t);
+    return 0;
 }
 
 
-/* MUU
+/* FLTS
  */
-static void muu(struct am_context *ctx) {
-    int overflow;
+static void flts(struct am_context *ctx) {
+    unsigned char *s;
+    int16 n;
 
-    if (IS_SINGLE) {
-        overflow = mulu16(stpos(-4), stpos(-2), stpos(-4));
-        dec_sp(2);
-    } else {
-        overflow = mulu32(stpos(-8), stpos(-4), stpos(-8));
-        dec_sp(4);
-    }
-    if (overflow)
-	ctx->status |= AM_ERR_OVF;
-    sz(ctx);
+    s = stpos(-2);
+    n = (int16)(s[0] | (s[1] << 8));
+    dec_sp(2);
+    am_push32(ctx, am_flt(n));
 }
 
 
-/* DIV
+/* FLTD
  */
-static void divi(struct am_context *ctx) {
-    int div0;
-
-    if (IS_SINGLE) {
-        div0 = div16(stpos(-4), stpos(-2), stpos(-4));
-        dec_sp(2);
-    } else {
-        div0 = div32(stpos(-8), stpos(-4), stpos(-8));
-        dec_sp(4);
-    }
-    if (div0)
-	ctx->status |= AM_ERR_DIV0;
-    sz(ctx);
+static void fltd(struct am_context *ctx) {
+    fw_st(stpos(-4), am_flt((int32)fw_ld(stpos(-4))));
+    st_fix(ctx, -4, 4);
 }
 
 
-/* Detect and report float overflow/underflow
+/* FIXS
+ *
+ * The float is truncated, and overflows if that does not fit. On
+ * overflow the float is left in place, and SIGN and ZERO follow the
+ * command width (as sz() does).
  */
-static int fov(struct am_context *ctx, double r) {
-    int e;
+static void fixs(struct am_context *ctx) {
+    int32 n;
 
-    frexp(r, &e);
-    if (e > 63) {
+    if (am_fix(fw_ld(stpos(-4)), 16, &n)) {
 	ctx->status |= AM_ERR_OVF;
-	return 1;
-    } else if (e < -64) {
-	ctx->status |= AM_ERR_UND;
-	return 1;
+	sz(ctx, stpos(-4));
+	return;
     }
-    return 0;
+    dec_sp(4);
+    am_push16(ctx, n);
+    szs(ctx, stpos(-4));
 }
 
 
-/* basicf - basic FADD/FSUB/FMUL/FDIV
- *
- * The guide says that overflow and underflow are detected on the
- * exponent. The mantissa is maintained, and the exponent is offset
- * by 128. So... that is what we do. Note that frexp() and ldexp()
- * should be implemented via bit operations, not arithmetic.
+/* FIXD
  */
-static void basicf(struct am_context *ctx) {
-    unsigned char *ap, *bp;
-    float a, b, r;
-    double m;
-    int e;
- 
-    ap = stpos(-4);
-    am_fp(ap, ctx->fptmp);
-    fp_na(ctx->fptmp, &a);
-
-    bp = stpos(-8);
-    am_fp(bp, ctx->fptmp);
-    fp_na(ctx->fptmp, &b);
-
-    switch (ctx->op_latch & AM_OP) {
-    case AM_FADD:
-        r = a + b;
-	break;
-    case AM_FSUB:
-        r = b - a;
-	break;
-    case AM_FMUL:
-        r = a * b;
-	break;
-    case AM_FDIV:
-	if (a == 0.0) {
-	    r = b;
-	    ctx->status |= AM_ERR_DIV0;
-	} else
-            r = b / a;
-	break;
-    }
+static void fixd(struct am_context *ctx) {
+    int32 n;
 
-    /* We do not use fov() because we want to bias exponent by 128
-     * on OVF/UND per the guide.
-     */
-    m = frexp(r, &e);
-    if (e > 63) {
+    if (am_fix(fw_ld(stpos(-4)), 32, &n)) {
 	ctx->status |= AM_ERR_OVF;
-	e -= 128;
-	r = ldexp(m, e);
-    } else if (e < -64) {
-	ctx->status |= AM_ERR_UND;
-	e += 128;
-	r = ldexp(m, e);
+	sz(ctx, stpos(-4));
+	return;
     }
-    na_fp(&r, ctx->fptmp);
-    fp_am(ctx->fptmp, bp);
-    dec_sp(4);
-    ctx->op_latch = AM_FLOAT;
-    sz(ctx);
+    fw_st(stpos(-4), (uint32)n);
+    st_fix(ctx, -4, 4);
+    szd(ctx, stpos(-4));
 }
+#endif
 
 
-/* SQRT EXP SIN COS TAN LN LOG etc (functions with single arg)
- *
- * Note that we use the -lm math library with GCC, and the -LF library
- * with HI-TECH C. This means we are limited to only using functions
- * that are in both. This explains the strange shenanigans with double
- * here.
+/* SADD
  */
-static void ffunc(struct am_context *ctx) {
-    unsigned char *ap;
-    float a;
-    double x;
+static void adds(struct am_context *ctx) {
+    ctx->status |= sadd(stpos(-4), stpos(-2), stpos(-4));
+    st_fix(ctx, -4, 2);
+    dec_sp(2);
+}
 
-    ap = stpos(-4);
-    am_fp(ap, ctx->fptmp);
-    fp_na(ctx->fptmp, &a);
 
-    x = a;
-    switch (ctx->op_latch & AM_OP) {
-    case AM_SQRT:
-        if (a < 0.0) {
-	    ctx->status |= AM_ERR_NEG;
-	    goto err;
-	}
-        x = sqrt(x);
-	break;
-    case AM_EXP:
-        /* -1.0 x 2^5 .. 1.0 x 2^5 */
-        if ((a < -32.0) || (a > 32.0)) {
-	    ctx->status |= AM_ERR_ARG;
-	    goto err;
-	}
-        x = exp(x);
-	break;
-    case AM_SIN:
-	x = sin(x);
-	break;
-    case AM_COS:
-	x = cos(x);
-	break;
-    case AM_TAN:
-	/* less than 2^-12 : return A as tan(A) */
-	if (a >= (1.0 / 4096.0))
-            x = tan(x);
-	break;
-    case AM_LN:
-	if (a < 0.0) {
-	    ctx->status |= AM_ERR_NEG;
-	    goto err;
-	}
-	x = log(x);
-	break;
-    case AM_LOG:
-	if (a < 0.0) {
-	    ctx->status |= AM_ERR_NEG;
-	    goto err;
-	}
-	x = log10(x);
-	break;
-    case AM_ASIN:
-	if ((a < -1.0) || (a > 1.0)) {
-	   ctx->status |= AM_ERR_ARG;
-	   goto err;
-	}
-	x = asin(x);
-	break;
-    case AM_ACOS:
-	if ((a < -1.0) || (a > 1.0)) {
-	   ctx->status |= AM_ERR_ARG;
-	   goto err;
-	}
-	x = acos(x);
-	break;
-    case AM_ATAN:
-	x = atan(x);
-	break;
-    }
-    if (fov(ctx, x))
-	goto err;
-    a = x;
-    na_fp(&a, ctx->fptmp);
-    fp_am(ctx->fptmp, ap);
-err:
-    ctx->op_latch = AM_FLOAT;
-    sz(ctx);
+/* DADD
+ */
+static void addd(struct am_context *ctx) {
+    ctx->status |= dadd(stpos(-8), stpos(-4), stpos(-8));
+    st_fix(ctx, -8, 4);
+    dec_sp(4);
 }
 
 
-/* PWR
- *
- * B^A = EXP( A * LN(B) )
+/* SSUB
  */
-static void pwr(struct am_context *ctx) {
-    /* B^A = EXP( A * LN(B) ) */
-    unsigned char *ap, *bp;
-    float a, b;
-    double x;
+static void subs(struct am_context *ctx) {
+    ctx->status |= ssub(stpos(-4), stpos(-2), stpos(-4));
+    st_fix(ctx, -4, 2);
+    dec_sp(2);
+}
 
-    /* A */
-    ap = stpos(-4);
-    am_fp(ap, ctx->fptmp);
-    fp_na(ctx->fptmp, &a);
 
-    /* B */
-    bp = stpos(-8);
-    am_fp(bp, ctx->fptmp);
-    fp_na(ctx->fptmp, &b);
+/* DSUB
+ */
+static void subd(struct am_context *ctx) {
+    ctx->status |= dsub(stpos(-8), stpos(-4), stpos(-8));
+    st_fix(ctx, -8, 4);
+    dec_sp(4);
+}
 
-    /* LN(B) */
-    if (b < 0.0) {
-	ctx->status |= AM_ERR_NEG;
-	goto err;
-    }
-    x = b;
-    x = log(x);
 
-    /* A * LN(B) */
-    x = (double)a * x;
+/* SMUL
+ */
+static void muls(struct am_context *ctx) {
+    if (mull16(stpos(-4), stpos(-2), stpos(-4)))
+	ctx->status |= AM_ERR_OVF;
+    st_fix(ctx, -4, 2);
+    dec_sp(2);
+}
 
-    /* EXP( A * LN(B) ) */
-    if ((x < -32.0) || (x > 32.0)) {
-        ctx->status |= AM_ERR_ARG;
-	goto err;
-    }
-    x = exp(x);
+
+/* DMUL
+ */
+static void muld(struct am_context *ctx) {
+    if (mull32(stpos(-8), stpos(-4), stpos(-8)))
+	ctx->status |= AM_ERR_OVF;
+    st_fix(ctx, -8, 4);
+    dec_sp(4);
+}
+
+
+/* SMUU
+ */
+static void muus(struct am_context *ctx) {
+    if (mulu16(stpos(-4), stpos(-2), stpos(-4)))
+	ctx->status |= AM_ERR_OVF;
+    st_fix(ctx, -4, 2);
+    dec_sp(2);
+}
+
+
+/* DMUU
+ */
+static void muud(struct am_context *ctx) {
+    if (mulu32(stpos(-8), stpos(-4), stpos(-8)))
+	ctx->status |= AM_ERR_OVF;
+    st_fix(ctx, -8, 4);
+    dec_sp(4);
+}
+
+
+/* SDIV
+ */
+static void divs(struct am_context *ctx) {
+    if (div16(stpos(-4), stpos(-2), stpos(-4)))
+	ctx->status |= AM_ERR_DIV0;
+    st_fix(ctx, -4, 2);
+    dec_sp(2);
+}
+
+
+/* DDIV
+ */
+static void divd(struct am_context *ctx) {
+    if (div32(stpos(-8), stpos(-4), stpos(-8)))
+	ctx->status |= AM_ERR_DIV0;
+    st_fix(ctx, -8, 4);
+    dec_sp(4);
+}
+
+
+#ifdef USE_AMFP
+
+/* FADD FSUB FMUL FDIV
+ *
+ * Done on the AM9511 format directly (amfp.c). Result replaces NOS,
+ * and the stack is rolled.
+ */
+static void fpadd(struct am_context *ctx) {
+    ctx->status |= afadd(stpos(-8), stpos(-4), stpos(-8));
+    st_fix(ctx, -8, 4);
+    dec_sp(4);
+}
+
+static void fpsub(struct am_context *ctx) {
+    ctx->status |= afsub(stpos(-8), stpos(-4), stpos(-8));
+    st_fix(ctx, -8, 4);
+    dec_sp(4);
+}
+
+static void fpmul(struct am_context *ctx) {
+    ctx->status |= afmul(stpos(-8), stpos(-4), stpos(-8));
+    st_fix(ctx, -8, 4);
+    dec_sp(4);
+}
+
+static void fpdiv(struct am_context *ctx) {
+    ctx->status |= afdiv(stpos(-8), stpos(-4), stpos(-8));
+    st_fix(ctx, -8, 4);
+    dec_sp(4);
+}
+
+
+/* SQRT EXP LN LOG
+ *
+ * Done on the AM9511 format directly (amfp.c). Result replaces TOS.
+ * On error (NEG or ARG), TOS is left alone.
+ */
+static void fnsqrt(struct am_context *ctx) {
+    ctx->status |= afsqrt(stpos(-4), stpos(-4));
+    st_fix(ctx, -4, 4);
+}
+
+static void fnexp(struct am_context *ctx) {
+    ctx->status |= afexp(stpos(-4), stpos(-4));
+    st_fix(ctx, -4, 4);
+}
+
+static void fnln(struct am_context *ctx) {
+    ctx->status |= afln(stpos(-4), stpos(-4));
+    st_fix(ctx, -4, 4);
+}
+
+static void fnlog(struct am_context *ctx) {
+    ctx->status |= aflog(stpos(-4), stpos(-4));
+    st_fix(ctx, -4, 4);
+}
+
+
+/* SIN COS TAN
+ *
+ * Done on the AM9511 format directly (amfp.c). Result replaces TOS.
+ */
+static void fnsin(struct am_context *ctx) {
+    ctx->status |= afsin(stpos(-4), stpos(-4));
+    st_fix(ctx, -4, 4);
+}
+
+static void fncos(struct am_context *ctx) {
+    ctx->status |= afcos(stpos(-4), stpos(-4));
+    st_fix(ctx, -4, 4);
+}
+
+static void fntan(struct am_context *ctx) {
+    ctx->status |= aftan(stpos(-4), stpos(-4));
+    st_fix(ctx, -4, 4);
+}
+
+
+/* ASIN ACOS ATAN
+ *
+ * Done on the AM9511 format directly (amfp.c). Result replaces TOS.
+ * Out of range ASIN and ACOS leave TOS alone.
+ */
+static void fnasin(struct am_context *ctx) {
+    ctx->status |= afasin(stpos(-4), stpos(-4));
+    st_fix(ctx, -4, 4);
+}
+
+static void fnacos(struct am_context *ctx) {
+    ctx->status |= afacos(stpos(-4), stpos(-4));
+    st_fix(ctx, -4, 4);
+}
+
+static void fnatan(struct am_context *ctx) {
+    ctx->status |= afatan(stpos(-4), stpos(-4));
+    st_fix(ctx, -4, 4);
+}
+
+
+/* PWR
+ *
+ * B^A, as one kernel (amfp.c). Result replaces B, and the stack is
+ * rolled. On error (NEG or ARG), the stack is left alone.
+ */
+static void pwr(struct am_context *ctx) {
+    int r;
+
+    r = afpwr(stpos(-8), stpos(-4), stpos(-8));
+    st_fix(ctx, -8, 4);
+    ctx->status |= r;
+    if (r == AM_ERR_NONE)
+	dec_sp(4);
+}
+
+#else
+
+/* Detect and report float overflow/underflow
+ */
+static int fov(struct am_context *ctx, double r) {
+    int e;
+
+    frexp(r, &e);
+    if (e > 63) {
+	ctx->status |= AM_ERR_OVF;
+	return 1;
+    } else if (e < -64) {
+	ctx->status |= AM_ERR_UND;
+	return 1;
+    }
+    return 0;
+}
+
+
+/* Fetch float operand from stack, or from its shadow
+ */
+static float farg(struct am_context *ctx, int offset) {
+    float x;
+    uint32 t;
+    int k;
+
+    k = sp_add(offset);
+    memcpy(&t, stpos(offset), 4);
+    if (t == ctx->ftag[k])
+	return ctx->fval[k];
+    am_na(stpos(offset), &x);
+    ctx->fval[k] = x;
+    ctx->ftag[k] = t;
+    return x;
+}
+
+
+/* Float result to stpos(offset), and to its shadow. Anything that
+ * does not fit (including NaN and infinity) is stored as 0.
+ */
+static void fres(struct am_context *ctx, int offset, float x) {
+    unsigned char *p = stpos(offset);
+    int k;
+
+    na_am(&x, p);
+    st_fix(ctx, offset, 4);
+    if ((p[2] & 0x80) == 0)
+	x = 0.0;
+    k = sp_add(offset);
+    ctx->fval[k] = x;
+    memcpy(&ctx->ftag[k], p, 4);
+}
+
+
+/* basicf - result of FADD/FSUB/FMUL/FDIV replaces NOS, and the
+ * stack is rolled.
+ *
+ * The guide says that overflow and underflow are detected on the
+ * exponent. The mantissa is maintained, and the exponent is offset
+ * by 128. So... that is what we do. Note that frexp() and ldexp()
+ * should be implemented via bit operations, not arithmetic.
+ */
+static void basicf(struct am_context *ctx, float r) {
+    double m;
+    int e;
+
+    /* We do not use fov() because we want to bias exponent by 128
+     * on OVF/UND per the guide.
+     */
+    m = frexp(r, &e);
+    if (e > 63) {
+	ctx->status |= AM_ERR_OVF;
+	e -= 128;
+	r = ldexp(m, e);
+    } else if (e < -64) {
+	ctx->status |= AM_ERR_UND;
+	e += 128;
+	r = ldexp(m, e);
+    }
+    fres(ctx, -8, r);
+    dec_sp(4);
+}
+
+
+/* FADD FSUB FMUL FDIV
+ */
+static void fpadd(struct am_context *ctx) {
+    basicf(ctx, farg(ctx, -8) + farg(ctx, -4));
+}
+
+static void fpsub(struct am_context *ctx) {
+    basicf(ctx, farg(ctx, -8) - farg(ctx, -4));
+}
+
+static void fpmul(struct am_context *ctx) {
+    basicf(ctx, farg(ctx, -8) * farg(ctx, -4));
+}
+
+static void fpdiv(struct am_context *ctx) {
+    float a, b;
+
+    a = farg(ctx, -4);
+    b = farg(ctx, -8);
+    if (a == 0.0) {
+	ctx->status |= AM_ERR_DIV0;
+	basicf(ctx, b);
+    } else
+	basicf(ctx, b / a);
+}
+
+
+/* ffunc - result of SQRT EXP SIN COS TAN LN LOG etc (functions with
+ * single arg) replaces TOS.
+ *
+ * Note that we use the -lm math library with GCC, and the -LF library
+ * with HI-TECH C. This means we are limited to only using functions
+ * that are in both. This explains the strange shenanigans with double
+ * here.
+ */
+static void ffunc(struct am_context *ctx, double x) {
+    float a;
+
+    if (fov(ctx, x))
+	return;
+    a = x;
+    fres(ctx, -4, a);
+}
+
+
+/* SQRT
+ */
+static void fnsqrt(struct am_context *ctx) {
+    float a = farg(ctx, -4);
+
+    if (a < 0.0) {
+	ctx->status |= AM_ERR_NEG;
+	return;
+    }
+    ffunc(ctx, sqrt((double)a));
+}
+
+
+/* EXP
+ */
+static void fnexp(struct am_context *ctx) {
+    float a = farg(ctx, -4);
+
+    /* -1.0 x 2^5 .. 1.0 x 2^5 */
+    if ((a < -32.0) || (a > 32.0)) {
+	ctx->status |= AM_ERR_ARG;
+	return;
+    }
+    ffunc(ctx, exp((double)a));
+}
+
+
+/* SIN COS
+ */
+static void fnsin(struct am_context *ctx) {
+    ffunc(ctx, sin((double)farg(ctx, -4)));
+}
+
+static void fncos(struct am_context *ctx) {
+    ffunc(ctx, cos((double)farg(ctx, -4)));
+}
+
+
+/* TAN
+ */
+static void fntan(struct am_context *ctx) {
+    double x = farg(ctx, -4);
+
+    /* less than 2^-12 : return A as tan(A) */
+    if (x >= (1.0 / 4096.0))
+	x = tan(x);
+    ffunc(ctx, x);
+}
+
+
+/* LN LOG
+ */
+static void fnln(struct am_context *ctx) {
+    float a = farg(ctx, -4);
+
+    if (a < 0.0) {
+	ctx->status |= AM_ERR_NEG;
+	return;
+    }
+    ffunc(ctx, log((double)a));
+}
+
+static void fnlog(struct am_context *ctx) {
+    float a = farg(ctx, -4);
+
+    if (a < 0.0) {
+	ctx->status |= AM_ERR_NEG;
+	return;
+    }
+    ffunc(ctx, log10((double)a));
+}
+
+
+/* ASIN ACOS
+ */
+static void fnasin(struct am_context *ctx) {
+    float a = farg(ctx, -4);
+
+    if ((a < -1.0) || (a > 1.0)) {
+	ctx->status |= AM_ERR_ARG;
+	return;
+    }
+    ffunc(ctx, asin((double)a));
+}
+
+static void fnacos(struct am_context *ctx) {
+    float a = farg(ctx, -4);
+
+    if ((a < -1.0) || (a > 1.0)) {
+	ctx->status |= AM_ERR_ARG;
+	return;
+    }
+    ffunc(ctx, acos((double)a));
+}
+
+
+/* ATAN
+ */
+static void fnatan(struct am_context *ctx) {
+    ffunc(ctx, atan((double)farg(ctx, -4)));
+}
+
+
+/* PWR
+ *
+ * B^A = EXP( A * LN(B) )
+ */
+static void pwr(struct am_context *ctx) {
+    /* B^A = EXP( A * LN(B) ) */
+    float a, b;
+    double x;
+
+    /* A */
+    a = farg(ctx, -4);
+
+    /* B */
+    b = farg(ctx, -8);
+
+    /* LN(B) */
+    if (b < 0.0) {
+	ctx->status |= AM_ERR_NEG;
+	return;
+    }
+    x = b;
+    x = log(x);
+
+    /* A * LN(B) */
+    x = (double)a * x;
+
+    /* EXP( A * LN(B) ) */
+    if ((x < -32.0) || (x > 32.0)) {
+        ctx->status |= AM_ERR_ARG;
+	return;
+    }
+    x = exp(x);
 
     if (fov(ctx, x))
-        goto err;
+        return;
 
     /* replace B with result */
     b = x;
-    na_fp(&b, ctx->fptmp);
-    fp_am(ctx->fptmp, bp);
+    fres(ctx, -8, b);
 
     /* roll stack */
     dec_sp(4);
-err:
-    sz(ctx);
 }
 
+#endif
 
-/* Issue am9511 command. Does not return until command
- * is complete.
+
+/* Command table.
+ *
+ * am_ops[] is indexed by the full command byte. Each entry holds the
+ * handler already specialized for the SINGLE or DOUBLE/FLOAT operand
+ * width, and the SIGN/ZERO setter for the result type, so that
+ * am_command() does no decoding at all. The table is built from
+ * am_opt[] (one entry per opcode) the first time a chip is created.
+ *
+ * SZ_MODE - SIGN/ZERO follow the width bits of the command
+ * SZ_FLT  - result is always float
+ * SZ_NONE - command sets no SIGN/ZERO (or sets its own)
  */
-void am_command(void *amp, unsigned char op) {
-    struct am_context *ctx = (struct am_context *)amp;
+#define SZ_MODE 0
+#define SZ_FLT  1
+#define SZ_NONE 2
+
+struct am_opt {
+    void (*single)(struct am_context *);
+    void (*other)(struct am_context *);
+    char szk;
+};
+
+struct am_op {
+    void (*fn)(struct am_context *);
+    void (*sz)(struct am_context *, unsigned char *);
+};
+
+static struct am_opt am_opt[32] = {
+    { nop,    nop,    SZ_NONE }, /* NOP  */
+    { fnsqrt, fnsqrt, SZ_FLT  }, /* SQRT */
+    { fnsin,  fnsin,  SZ_FLT  }, /* SIN  */
+    { fncos,  fncos,  SZ_FLT  }, /* COS  */
+    { fntan,  fntan,  SZ_FLT  }, /* TAN  */
+    { fnasin, fnasin, SZ_FLT  }, /* ASIN */
+    { fnacos, fnacos, SZ_FLT  }, /* ACOS */
+    { fnatan, fnatan, SZ_FLT  }, /* ATAN */
+    { fnlog,  fnlog,  SZ_FLT  }, /* LOG  */
+    { fnln,   fnln,   SZ_FLT  }, /* LN   */
+    { fnexp,  fnexp,  SZ_FLT  }, /* EXP  */
+    { pwr,    pwr,    SZ_MODE }, /* PWR  */
+    { adds,   addd,   SZ_MODE }, /* ADD  */
+    { subs,   subd,   SZ_MODE }, /* SUB  */
+    { muls,   muld,   SZ_MODE }, /* MUL  */
+    { divs,   divd,   SZ_MODE }, /* DIV  */
+    { fpadd,  fpadd,  SZ_FLT  }, /* FADD */
+    { fpsub,  fpsub,  SZ_FLT  }, /* FSUB */
+    { fpmul,  fpmul,  SZ_FLT  }, /* FMUL */
+    { fpdiv,  fpdiv,  SZ_FLT  }, /* FDIV */
+    { chss,   chsd,   SZ_MODE }, /* CHS  */
+    { chsf,   chsf,   SZ_MODE }, /* CHSF */ /* per Wayne Hortensius */
+    { muus,   muud,   SZ_MODE }, /* MUU  */
+    { ptos,   ptod,   SZ_MODE }, /* PTO  */
+    { pops,   popd,   SZ_MODE }, /* POP  */
+    { xchs,   xchd,   SZ_MODE }, /* XCH  */
+    { pupi,   pupi,   SZ_MODE }, /* PUPI */
+    { nop,    nop,    SZ_NONE }, /* 0x1b */
+    { fltd,   fltd,   SZ_FLT  }, /* FLTD */
+    { flts,   flts,   SZ_FLT  }, /* FLTS */
+    { fixd,   fixd,   SZ_NONE }, /* FIXD */
+    { fixs,   fixs,   SZ_NONE }  /* FIXS */
+};
+
+static struct am_op am_ops[256];
+static int am_opinit = 0;            /* 1: being built, 2: built */
+
+
+/* Build am_ops[] from am_opt[]
+ */
+static void am_mkops(void) {
+    struct am_opt *t;
+    struct am_op *p;
+    int i;
+
+    for (i = 0; i < 256; ++i) {
+	t = &am_opt[i & AM_OP];
+	p = &am_ops[i];
+	if ((i & AM_SINGLE) == AM_SINGLE) {
+	    p->fn = t->single;
+	    p->sz = szs;
+	} else {
+	    p->fn = t->other;
+	    p->sz = (i & AM_FIXED) ? szd : szf;
+	}
+	if (t->szk == SZ_FLT)
+	    p->sz = szf;
+	else if (t->szk == SZ_NONE)
+	    p->sz = szn;
+    }
+}
+
+
+/* Build am_ops[] the first time a chip is set up. On the host, chips
+ * may be set up by several threads at once: one builds the table, and
+ * the others wait for it.
+ */
+static void am_ops_init(void) {
+#ifndef z80
+    int s = 0;
+
+    if (__atomic_load_n(&am_opinit, __ATOMIC_ACQUIRE) == 2)
+	return;
+    if (__atomic_compare_exchange_n(&am_opinit, &s, 1, 0,
+				    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+	am_mkops();
+	__atomic_store_n(&am_opinit, 2, __ATOMIC_RELEASE);
+	return;
+    }
+    while (__atomic_load_n(&am_opinit, __ATOMIC_ACQUIRE) != 2)
+	;
+#else
+    if (!am_opinit) {
+	am_mkops();
+	am_opinit = 2;
+    }
+#endif
+}
+
+
+/* Run command
+ */
+static void am_do(struct am_context *ctx, unsigned char op) {
+    struct am_op *p = &am_ops[op];
+    unsigned char *t;
 
     ctx->op_latch = op;
 
@@ -665,102 +1346,364 @@ void am_command(void *amp, unsigned char op) {
 #endif
 
     ctx->status = AM_BUSY;
+    (*p->fn)(ctx);
+    t = stpos(-4);
+    ctx->szb[0] = t[0];
+    ctx->szb[1] = t[1];
+    ctx->szb[2] = t[2];
+    ctx->szb[3] = t[3];
+    ctx->szp = p->sz;
+    ctx->status &= ~AM_BUSY;
+}
 
-    switch (ctx->op_latch & AM_OP) {
 
-    case AM_NOP:  /* no operation */
-	ctx->status = 0;
-        break;
+#ifdef AM_ASYNC
 
-    case AM_PUPI: /* push pi */
-	pupi(ctx);
-	break;
+/* Asynchronous commands (host, -DAM_ASYNC). With am_async() on, a
+ * chip's slow commands (SQRT to PWR) go on a queue for a pool of
+ * worker threads, shared by all chips. am_command() returns at once,
+ * and am_status() gives BUSY until the command is done, as the chip
+ * does, so the guest can get on with other work while it polls. The
+ * other commands are quicker than the hand off, and are done at once.
+ *
+ * A chip has at most one command with the workers. Anything else done
+ * to the chip (push, pop, another command) waits for it first. While
+ * no workers run, slow commands are done at once too.
+ *
+ * am_lock guards the queue, and am_nthr and am_stop. am_wlock keeps
+ * starting and stopping the workers to one thread at a time.
+ */
+static pthread_mutex_t am_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t am_wlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  am_work = PTHREAD_COND_INITIALIZER; /* queued */
+static pthread_cond_t  am_done = PTHREAD_COND_INITIALIZER; /* finished */
+static struct am_context *am_head = NULL;  /* queue */
+static struct am_context *am_tail = NULL;
+static int am_nwait = 0;                   /* waiting on am_done */
+static int am_nthr = 0;                    /* workers running */
+static int am_stop = 0;                    /* workers to exit */
+static pthread_t *am_thr = NULL;
+
+#define am_slow(op) (((unsigned)((op) & AM_OP) - AM_SQRT) <= AM_PWR - AM_SQRT)
+
+
+/* Worker thread: take chips off the queue, and do their commands.
+ * Exits when stopped and the queue is empty.
+ */
+static void *am_worker(void *arg) {
+    struct am_context *ctx;
+
+    arg = arg;
+    pthread_mutex_lock(&am_lock);
+    for (;;) {
+	while ((am_head == NULL) && !am_stop)
+	    pthread_cond_wait(&am_work, &am_lock);
+	if (am_head == NULL)
+	    break;
+	ctx = am_head;
+	am_head = ctx->next;
+	if (am_head == NULL)
+	    am_tail = NULL;
+	pthread_mutex_unlock(&am_lock);
+
+	am_do(ctx, ctx->aop);
+
+	pthread_mutex_lock(&am_lock);
+	__atomic_store_n(&ctx->pend, 0, __ATOMIC_RELEASE);
+	if (am_nwait)
+	    pthread_cond_broadcast(&am_done);
+    }
+    pthread_mutex_unlock(&am_lock);
+    return NULL;
+}
 
-    case AM_CHS:  /* change sign */
-	chs(ctx);
-	break;
 
-    case AM_CHSF: /* float change sign */
-	chsf(ctx); /* per Wayne Hortensius */
-	break;
+/* Give command op to the workers, or do it here if there are none
+ * (or they are being stopped)
+ */
+static void am_post(struct am_context *ctx, unsigned char op) {
+    pthread_mutex_lock(&am_lock);
+    if ((am_nthr == 0) || am_stop) {
+	pthread_mutex_unlock(&am_lock);
+	am_do(ctx, op);
+	return;
+    }
+    ctx->aop = op;
+    ctx->next = NULL;
+    __atomic_store_n(&ctx->pend, 1, __ATOMIC_RELAXED);
+    if (am_tail == NULL)
+	am_head = ctx;
+    else
+	am_tail->next = ctx;
+    am_tail = ctx;
+    pthread_cond_signal(&am_work);
+    pthread_mutex_unlock(&am_lock);
+}
 
-    case AM_POP:  /* pop */
-	pop(ctx);
-        break;
 
-    case AM_PTO:  /* push tos (copy) */
-	pto(ctx);
-        break;
+/* Wait until the workers are done with ctx
+ */
+static void am_wait(struct am_context *ctx) {
+    pthread_mutex_lock(&am_lock);
+    ++am_nwait;
+    while (__atomic_load_n(&ctx->pend, __ATOMIC_ACQUIRE))
+	pthread_cond_wait(&am_done, &am_lock);
+    --am_nwait;
+    pthread_mutex_unlock(&am_lock);
+}
 
-    case AM_XCH:  /* exchange tos and nos */
-	xch(ctx);
-        break;
 
-    case AM_FLTD: /* 32 bit to float */
-	fltd(ctx);
-        break;
+/* am_workers() with am_wlock held
+ */
+static int am_start(int n) {
+    int i;
 
-    case AM_FLTS: /* 16 bit to float */
-	flts(ctx);
-        break;
+    if (am_nthr > 0) {
+	pthread_mutex_lock(&am_lock);
+	am_stop = 1;
+	pthread_cond_broadcast(&am_work);
+	pthread_mutex_unlock(&am_lock);
+	for (i = 0; i < am_nthr; ++i)
+	    pthread_join(am_thr[i], NULL);
+	free(am_thr);
+	am_thr = NULL;
+	pthread_mutex_lock(&am_lock);
+	am_nthr = 0;
+	am_stop = 0;
+	pthread_mutex_unlock(&am_lock);
+    }
+    if (n == 0)
+	return 0;
+    if (n < 0)
+	n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1)
+	n = 1;
+    am_thr = malloc(n * sizeof (pthread_t));
+    if (am_thr == NULL)
+	return 0;
+    for (i = 0; i < n; ++i)
+	if (pthread_create(&am_thr[i], NULL, am_worker, NULL) != 0)
+	    break;
+    if (i == 0) {
+	free(am_thr);
+	am_thr = NULL;
+    }
+    pthread_mutex_lock(&am_lock);
+    am_nthr = i;
+    pthread_mutex_unlock(&am_lock);
+    return i;
+}
 
-    case AM_FIXD: /* float to 32 bit */
-	fixd(ctx);
-        break;
 
-    case AM_FIXS: /* float to 16 bit */
-	fixs(ctx);
-        break;
+/* Start n worker threads (n < 1: one per CPU), after stopping any
+ * that are running (their queue is finished first). n == 0 just
+ * stops them. Returns the number running.
+ */
+int am_workers(int n) {
+    pthread_mutex_lock(&am_wlock);
+    n = am_start(n);
+    pthread_mutex_unlock(&am_wlock);
+    return n;
+}
 
-    case AM_ADD:  /* add */
-	add(ctx);
-	break;
 
-    case AM_SUB:  /* subtract nos-tos */
-	sub(ctx);
-        break;
+/* Turn asynchronous commands on or off for a chip. The workers are
+ * started (one per CPU) if none are running. Returns 0, or -1 if no
+ * worker could be started (the chip stays synchronous).
+ */
+int am_async(void *amp, int on) {
+    struct am_context *ctx = (struct am_context *)amp;
 
-    case AM_MUL:  /* multiply, lower half */
-	mul(ctx);
-        break;
+    am_sync(ctx);
+    if (on) {
+	pthread_mutex_lock(&am_wlock);
+	if ((am_nthr == 0) && (am_start(-1) == 0)) {
+	    pthread_mutex_unlock(&am_wlock);
+	    ctx->async = 0;
+	    return -1;
+	}
+	pthread_mutex_unlock(&am_wlock);
+    }
+    ctx->async = on != 0;
+    return 0;
+}
 
-    case AM_MUU:  /* multiply, upper half */
-	muu(ctx);
-        break;
+#endif
 
-    case AM_DIV:  /* divide nos/tos */
-	divi(ctx);
-        break;
 
-    case AM_FADD: /* floating add */
-    case AM_FSUB: /* floating subtract */
-    case AM_FMUL: /* floating multiply */
-    case AM_FDIV: /* floating divide */
-	basicf(ctx);
-        break;
+/* Issue am9511 command. Does not return until command
+ * is complete (unless am_async() is on).
+ */
+void am_command(void *amp, unsigned char op) {
+    struct am_context *ctx = (struct am_context *)amp;
 
-    case AM_SQRT: /* square root */
-    case AM_EXP:  /* exponential (e^x) */
-    case AM_SIN:  /* sine */
-    case AM_COS:  /* cosine */
-    case AM_TAN:  /* tangent */
-    case AM_LOG:  /* common logarithm (base 10) */
-    case AM_LN:   /* natural logarthm (base e) */
-    case AM_ASIN: /* inverse sine */
-    case AM_ACOS: /* inverse cosine */
-    case AM_ATAN: /* inverse tangent */
-	ffunc(ctx);
-        break;
+    am_sync(ctx);
+#ifdef AM_ASYNC
+    if (ctx->async && am_slow(op)) {
+	am_post(ctx, op);
+	return;
+    }
+#endif
+    am_do(ctx, op);
+}
 
-    case AM_PWR:  /* power nos^tos */
-	pwr(ctx);
-        break;
 
-    default:
-        break;
+/* Run a batch of pushes, commands, pops and status reads, given as
+ * n bytes at in (see am9511.h for the format). Popped bytes and status
+ * snapshots are written to out, in order.
+ *
+ * Returns the number of bytes written to out, or -1 if the batch is
+ * malformed (everything before the bad entry has been done).
+ */
+int am_exec(void *amp, unsigned char *in, int n, unsigned char *out) {
+    struct am_context *ctx = (struct am_context *)amp;
+    unsigned char *end = in + n;
+    unsigned char *o = out;
+    int k, sp;
+
+    am_sync(ctx);
+    while (in < end) {
+	switch (*in++) {
+	case AM_XPUSH:
+	    if ((in == end) || (*in > end - in - 1))
+		return -1;
+	    k = *in++;
+	    sp = ctx->sp;
+	    while (k--) {
+		ctx->stack[sp] = ctx->stack[sp + 16] = *in++;
+		sp = (sp + 1) & 0xf;
+	    }
+	    ctx->sp = sp;
+	    break;
+	case AM_XCMD:
+	    if (in == end)
+		return -1;
+	    am_do(ctx, *in++);
+	    break;
+	case AM_XPOP:
+	    if (in == end)
+		return -1;
+	    k = *in++;
+	    sp = ctx->sp;
+	    while (k--) {
+		sp = (sp - 1) & 0xf;
+		*o++ = ctx->stack[sp];
+	    }
+	    ctx->sp = sp;
+	    break;
+	case AM_XSTAT:
+	    sz_now();
+	    *o++ = ctx->status;
+	    break;
+	default:
+	    return -1;
+	}
     }
+    return o - out;
+}
 
-    ctx->status &= ~AM_BUSY;
+
+/* Execution time of each command, in chip clock cycles. These are
+ * from the Am9511A data sheet, which gives a range for most commands
+ * (depending on the operands). We use the middle of the range.
+ *
+ * Columns are SINGLE, DOUBLE and FLOAT width (for commands that only
+ * have one form, all three are the same).
+ */
+static unsigned short am_time[32][3] = {
+    {    4,    4,     4 }, /* NOP  */
+    {  826,  826,   826 }, /* SQRT  782-870 */
+    { 4302, 4302,  4302 }, /* SIN  3796-4808 */
+    { 4359, 4359,  4359 }, /* COS  3840-4878 */
+    { 5390, 5390,  5390 }, /* TAN  4894-5886 */
+    { 7084, 7084,  7084 }, /* ASIN 6230-7938 */
+    { 7294, 7294,  7294 }, /* ACOS 6304-8284 */
+    { 5764, 5764,  5764 }, /* ATAN 4992-6536 */
+    { 5803, 5803,  5803 }, /* LOG  4474-7132 */
+    { 5627, 5627,  5627 }, /* LN   4298-6956 */
+    { 4336, 4336,  4336 }, /* EXP  3794-4878 */
+    {10161,10161, 10161 }, /* PWR  8290-12032 */
+    {   17,   21,    17 }, /* ADD  16-18, 20-22 */
+    {   31,   39,    31 }, /* SUB  30-32, 38-40 */
+    {   89,  202,    89 }, /* MUL  84-94, 194-210 */
+    {   89,  203,    89 }, /* DIV  84-94, 196-210 */
+    {  211,  211,   211 }, /* FADD 54-368 */
+    {  220,  220,   220 }, /* FSUB 70-370 */
+    {  157,  157,   157 }, /* FMUL 146-168 */
+    {  169,  169,   169 }, /* FDIV 154-184 */
+    {   23,   27,    23 }, /* CHS  22-24, 26-28 */
+    {   18,   18,    18 }, /* CHSF 16-20 */
+    {   89,  200,    89 }, /* MUU  80-98, 182-218 */
+    {   16,   20,    20 }, /* PTO  */
+    {   10,   12,    12 }, /* POP  */
+    {   18,   26,    26 }, /* XCH  */
+    {   16,   16,    16 }, /* PUPI */
+    {    4,    4,     4 }, /* 0x1b */
+    {  199,  199,   199 }, /* FLTD 56-342 */
+    {  109,  109,   109 }, /* FLTS 62-156 */
+    {  213,  213,   213 }, /* FIXD 90-336 */
+    {  152,  152,   152 }  /* FIXS 90-214 */
+};
+
+
+/* Return execution time of command, in chip clock cycles
+ */
+unsigned am_cycles(unsigned char op) {
+    unsigned short *t = am_time[op & AM_OP];
+
+    if ((op & AM_SINGLE) == AM_SINGLE)
+	return t[0];
+    if (op & AM_FIXED)
+	return t[1];
+    return t[2];
+}
+
+
+/* Set host and chip clock rates (in kHz) for am_tcmd(). The default
+ * is one host tstate per chip cycle. A chip rate of 0 turns timing
+ * off: commands are done at the tstate they are issued.
+ */
+void am_clock(void *amp, unsigned cpu, unsigned chip) {
+    struct am_context *ctx = (struct am_context *)amp;
+
+    if (chip == 0)
+	ctx->tscale = 0;
+    else
+	ctx->tscale = ((unsigned long)cpu << 8) / chip;
+}
+
+
+/* Issue am9511 command at host time now (in tstates). The command
+ * is done at once, but BUSY stays set until am_tstat() is given a
+ * time at or after the returned completion time.
+ *
+ * am_command() is the "instant" version of this, and does no timing
+ * at all.
+ */
+unsigned long am_tcmd(void *amp, unsigned char op, unsigned long now) {
+    struct am_context *ctx = (struct am_context *)amp;
+
+    am_sync(ctx);
+    am_do(ctx, op);
+    ctx->done = now + ((am_cycles(op) * ctx->tscale) >> 8);
+    ctx->status |= AM_BUSY;
+    return ctx->done;
+}
+
+
+/* Return status of am9511 at host time now (in tstates). BUSY is
+ * cleared once the command issued by am_tcmd() is complete. The
+ * compare allows the tstates counter to wrap.
+ */
+unsigned char am_tstat(void *amp, unsigned long now) {
+    struct am_context *ctx = (struct am_context *)amp;
+
+    am_sync(ctx);
+    if ((ctx->status & AM_BUSY) &&
+	((long)(now - ctx->done) >= 0))
+	ctx->status &= ~AM_BUSY;
+    sz_now();
+    return ctx->status;
 }
 
 
@@ -770,34 +1713,162 @@ void am_reset(void *amp) {
     struct am_context *ctx = (struct am_context *)amp;
     int i;
 
+    am_sync(ctx);
     ctx->sp = 0;
     ctx->status = 0;
+    ctx->szp = NULL;
     ctx->op_latch = 0;
     ctx->last_latch = 0;
-    for (i = 0; i < 16; ++i)
+    ctx->done = 0;
+    for (i = 0; i < 32; ++i)
 	ctx->stack[i] = 0;
+#ifndef USE_AMFP
+    for (i = 0; i < 16; ++i) {
+	ctx->fval[i] = 0.0;
+	ctx->ftag[i] = 0;
+    }
+#endif
+}
+
+
+/* Size of chip context, for am_init()
+ */
+size_t am_size(void) {
+    return sizeof (struct am_context);
+}
+
+
+/* Set up chip in caller's storage (am_size() bytes, aligned as for
+ * malloc()). Uses no heap. Returns storage.
+ */
+void *am_init(void *storage, int status, int data) {
+    struct am_context *p = (struct am_context *)storage;
+
+    status = status;
+    data = data;
+    p->tscale = 256;
+#ifdef AM_ASYNC
+    p->pend = 0;
+    p->async = 0;
+    p->next = NULL;
+#endif
+    am_ops_init();
+    am_reset(p);
+    return storage;
+}
+
+
+#ifdef AM_POOL
+
+/* Chip pool (host, -DAM_POOL). am_create() takes contexts from slabs
+ * of AM_SLAB slots, each a whole number of AM_LINE byte cache lines
+ * and starting on a line boundary, and am_destroy() puts them on a
+ * free list for reuse. Slabs are never given back. am_plock guards
+ * the free list and the counts, so any thread may create and destroy
+ * chips.
+ */
+#define AM_LINE 64
+#define AM_SLAB 64
+
+#define AM_SLOT (((sizeof (struct am_context) + AM_LINE - 1) / AM_LINE) * \
+		 AM_LINE)
+
+static pthread_mutex_t am_plock = PTHREAD_MUTEX_INITIALIZER;
+static void *am_free = NULL;         /* free slots, linked through slot */
+static unsigned long am_nused = 0;   /* slots in use */
+static unsigned long am_nslot = 0;   /* slots in all slabs */
+
+
+/* Add a slab to the free list (am_plock held). Returns 0 if out of
+ * memory.
+ */
+static int am_slab(void) {
+    unsigned char *p;
+    size_t a;
+    int i;
+
+    p = malloc(AM_SLAB * AM_SLOT + AM_LINE - 1);
+    if (p == NULL)
+	return 0;
+    a = (size_t)p;
+    p += (AM_LINE - (a % AM_LINE)) % AM_LINE;
+    for (i = 0; i < AM_SLAB; ++i) {
+	*(void **)p = am_free;
+	am_free = p;
+	p += AM_SLOT;
+    }
+    am_nslot += AM_SLAB;
+    return 1;
+}
+
+
+/* Pool occupancy: slots in use, and slots in all slabs
+ */
+void am_pool(unsigned long *used, unsigned long *slots) {
+    pthread_mutex_lock(&am_plock);
+    *used = am_nused;
+    *slots = am_nslot;
+    pthread_mutex_unlock(&am_plock);
 }
 
 
 /* Create chip.
  */
 void *am_create(int status, int data) {
-    struct am_context *p;
-    void *fpp;
-    fpp = malloc(fp_size());
-    if (fpp == NULL)
-	return NULL;
-    p = malloc(sizeof (struct am_context));
-    if (p == NULL) {
-        free(fpp);
+    void *p;
+
+    pthread_mutex_lock(&am_plock);
+    if ((am_free == NULL) && !am_slab()) {
+	pthread_mutex_unlock(&am_plock);
 	return NULL;
     }
-    p->fptmp = fpp;
-    am_reset(p);
-    return (void *)p;
+    p = am_free;
+    am_free = *(void **)p;
+    ++am_nused;
+    pthread_mutex_unlock(&am_plock);
+    return am_init(p, status, data);
 }
 
 
+/* Destroy chip made by am_create(). Not for am_init() chips.
+ */
+void am_destroy(void *amp) {
+    if (amp == NULL)
+	return;
+    am_sync((struct am_context *)amp);
+    pthread_mutex_lock(&am_plock);
+    *(void **)amp = am_free;
+    am_free = amp;
+    --am_nused;
+    pthread_mutex_unlock(&am_plock);
+}
+
+#else
+
+/* Create chip.
+ */
+void *am_create(int status, int data) {
+    void *p;
+
+    p = malloc(am_size());
+    if (p == NULL)
+	return NULL;
+    return am_init(p, status, data);
+}
+
+
+/* Destroy chip made by am_create()
+ */
+void am_destroy(void *amp) {
+    if (amp == NULL)
+	return;
+    am_sync((struct am_context *)amp);
+    free(amp);
+}
+
+#endif
+
+
 /* Dump stack A..H or A..D, format depends on arg (AM_SINGLE,
  * AM_DOUBLE, AM_FLOAT). Dump status and last op_latch.
  */
@@ -807,7 +1878,7 @@ void am_dump(void *amp, unsigned char op) {
     int16 n;
     int32 nl;
     float x;
-    unsigned char t = ctx->status;
+    unsigned char t;
     int b;
     static char *opnames[] = {
         "NOP",  "SQRT", "SIN",  "COS",
@@ -820,6 +1891,9 @@ void am_dump(void *amp, unsigned char op) {
         "FLTD", "FLTS", "FIXD", "FIXS"
     };
 
+    am_sync(ctx);
+    sz_now();
+    t = ctx->status;
     printf("AM9511 STATUS: %02x ", ctx->status);
         if (t & AM_BUSY)  printf("BUSY ");
         if (t & AM_SIGN)  printf("SIGN ");
@@ -896,8 +1970,7 @@ void am_dump(void *amp, unsigned char op) {
 #endif
 		printf("%ld\n", (long)nl);
 	    } else {
-		am_fp(stpos(-(i * 4) - 4), ctx->fptmp);
-		fp_na(ctx->fptmp, &x);
+		am_na(stpos(-(i * 4) - 4), &x);
 		printf("%g\n", x);
 	    }
 	}
@@ -4,21 +4,23 @@
 #ifndef _AM9511_H
 #define _AM9511_H
 
+#include <stddef.h>
+
 /* Smallest and largest numbers in the AM9511 floating point
  * format. 0.5x2^-64 to 0.99999..x2^63.
  *
- * As a note: these values can be exactly computed:
- *
- * unsigned char am_small[4], am_big[4];
- * fp_put(0, -64, 0x80, 0x0000); will generate AM_SMALL
- * fp_am(am_small);
- * fp_put(0,  63, 0xff, 0xffff); will generate AM_BIG
- * fp_am(am_big);
+ * The _W values are these (and pi) exactly, as AM9511 words (am9511.c
+ * checks them against FW_AM() of floatcnv.h at compile time), and
+ * FW_BYTES(AM_PI_W) are the bytes in push order.
  */
 #define AM_SMALL    2.71051e-20
 #define AM_BIG      9.22337e+18
 #define AM_PI       3.141592
 
+#define AM_SMALL_W  0x40800000UL
+#define AM_BIG_W    0x3fffffffUL
+#define AM_PI_W     0x02c90fdaUL
+
 #define AM_SR       0x80 /* service request on completion */
 #define AM_SINGLE   0x60 /* 16 bit integer */
 #define AM_DOUBLE   0x20 /* 32 bit integer */
@@ -71,12 +73,64 @@
 #define AM_ERR_UND  0x04 /* underflow */
 #define AM_ERR_OVF  0x02 /* overflow */
 
+/* am_exec() batch entries. The output gets n bytes for AM_XPOP, and
+ * one byte (the status) for AM_XSTAT.
+ *
+ *   AM_XPUSH n b1 .. bn  push n bytes
+ *   AM_XCMD op           command
+ *   AM_XPOP n            pop n bytes
+ *   AM_XSTAT             read status
+ */
+#define AM_XPUSH    0x01
+#define AM_XCMD     0x02
+#define AM_XPOP     0x03
+#define AM_XSTAT    0x04
+
 void         *am_create(int status, int data);
+size_t        am_size(void);
+void         *am_init(void *, int status, int data);
+void          am_destroy(void *);
 void          am_push(void *, unsigned char);
 unsigned char am_pop(void *);
 unsigned char am_status(void *);
 void          am_command(void *, unsigned char);
 void          am_reset(void *);
+int           am_exec(void *, unsigned char *, int, unsigned char *);
+
+/* Bulk push/pop of whole operands (host only). f is AM9511 float (4
+ * bytes, in push order), n is host float.
+ */
+#ifndef z80
+void          am_push16(void *, int);
+void          am_push32(void *, long);
+void          am_pushf(void *, unsigned char *);
+int           am_pushn(void *, float);
+int           am_pop16(void *);
+long          am_pop32(void *);
+void          am_popf(void *, unsigned char *);
+float         am_popn(void *);
+#endif
+
+/* Occupancy of the pool am_create() takes chips from (host only,
+ * am9511.c built with -DAM_POOL)
+ */
+#ifdef AM_POOL
+void          am_pool(unsigned long *used, unsigned long *slots);
+#endif
+
+/* Asynchronous commands (host only, am9511.c built with -DAM_ASYNC)
+ */
+#ifdef AM_ASYNC
+int           am_async(void *, int on);
+int           am_workers(int n);
+#endif
+
+/* Timed commands (see am9511.c). am_command() is not timed.
+ */
+unsigned      am_cycles(unsigned char);
+void          am_clock(void *, unsigned, unsigned);
+unsigned long am_tcmd(void *, unsigned char, unsigned long);
+unsigned char am_tstat(void *, unsigned long);
 
 #ifdef NDEBUG
 #define am_dump(x)
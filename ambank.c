@@ -0,0 +1,750 @@
+/* ambank.c
+ *
+ * A bank of AM9511 chips, held as parallel arrays (structure of
+ * arrays): stacks (16 bytes, mirrored to 32 as in am9511.c, so that
+ * an operand is always contiguous), stack pointers, status and
+ * operator latches. Host only.
+ *
+ * ab_run() is given a list of (chip, command) pairs, and groups them
+ * by opcode. Each group is done in passes over up to AB_CHUNK chips:
+ * gather the operands into arrays, compute (plain loops over the
+ * arrays, written so that gcc -O3 vectorizes them), and scatter the
+ * results and status back. The pass is compiled twice on x86, for
+ * SSE2 and for AVX2, and the first ab_create() picks the one the CPU
+ * can run. If a chip is in the list more than once, its commands are
+ * done in list order: the n-th command for each chip is in the n-th
+ * round.
+ *
+ * ADD SUB CHS (16 and 32 bit), FADD FSUB FMUL FDIV CHSF, PTO POP XCH
+ * PUPI and NOP have kernels here, which give the same stack bytes and
+ * status as am9511.c (quirks included). Other commands -- and the
+ * float commands, if compiled with USE_AMFP -- are run one chip at a
+ * time on a scratch am9511.c chip.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "am9511.h"
+#include "ambank.h"
+#include "floatcnv.h"
+#include "types.h"
+
+
+#define AB_CHUNK 256   /* chips per kernel pass */
+
+#define AM_OP    0x1f
+
+#if defined(__GNUC__) && !defined(__TINYC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define AB_X86
+#endif
+
+/* The pass and what it calls are inlined into each compiled copy of
+ * it, so that all of it is built for that copy's instruction set
+ */
+#ifdef __GNUC__
+#define AB_INLINE static __inline__ __attribute__((always_inline))
+#else
+#define AB_INLINE static
+#endif
+
+
+/* Kernels
+ */
+#define K_SLOW   0     /* scratch am9511.c chip */
+#define K_NOP    1
+#define K_ADD16  2
+#define K_ADD32  3
+#define K_SUB16  4
+#define K_SUB32  5
+#define K_CHS16  6
+#define K_CHS32  7
+#define K_CHSF   8
+#define K_FADD   9
+#define K_FSUB  10
+#define K_FMUL  11
+#define K_FDIV  12
+#define K_PTO   13
+#define K_POP   14
+#define K_XCH   15
+#define K_PUPI  16
+
+
+/* SIGN and ZERO, as am_mkops() in am9511.c picks them
+ */
+#define SZ_NONE  0
+#define SZ_S     1
+#define SZ_D     2
+#define SZ_F     3
+
+
+struct ab_bank {
+    int n;
+    unsigned char (*stack)[32];
+    unsigned char *sp;
+    unsigned char *status;
+    unsigned char *latch;
+    int *round;                /* ab_run(): commands seen, per chip */
+    int cap;                   /* ab_run(): room in rn, iy, ix */
+    int *rn;                   /* ab_run(): round of each command */
+    int *iy;                   /* ab_run(): commands in round order */
+    int *ix;                   /* ab_run(): commands in group order */
+    void *chip;                /* for K_SLOW */
+
+    /* Kernel pass
+     */
+    int lane[AB_CHUNK];        /* chip */
+    uint32 a[AB_CHUNK];        /* NOS (or only) operand */
+    uint32 b[AB_CHUNK];        /* TOS operand */
+    uint32 r[AB_CHUNK];        /* result */
+    float fa[AB_CHUNK];
+    float fb[AB_CHUNK];
+    float fr[AB_CHUNK];
+    unsigned char e[AB_CHUNK]; /* error and CARRY bits */
+};
+
+
+typedef void ab_fn(struct ab_bank *, int, unsigned char);
+
+static unsigned char ab_kern[256];
+static unsigned char ab_szk[256];
+static ab_fn *ab_pass;               /* ab_pass_sc() or ab_pass_a2() */
+static int ab_opinit = 0;            /* 1: being built, 2: built */
+
+
+/* Build ab_kern[] and ab_szk[]
+ */
+static void ab_mkops(void) {
+    int i, single;
+    unsigned char k, z;
+
+    for (i = 0; i < 256; ++i) {
+	single = (i & AM_SINGLE) == AM_SINGLE;
+	k = K_SLOW;
+	z = single ? SZ_S : ((i & AM_FIXED) ? SZ_D : SZ_F);
+	switch (i & AM_OP) {
+	case AM_NOP:
+	case 0x1b:
+	    k = K_NOP;
+	    z = SZ_NONE;
+	    break;
+	case AM_ADD:
+	    k = single ? K_ADD16 : K_ADD32;
+	    break;
+	case AM_SUB:
+	    k = single ? K_SUB16 : K_SUB32;
+	    break;
+	case AM_CHS:
+	    k = single ? K_CHS16 : K_CHS32;
+	    break;
+	case AM_CHSF:
+	    k = K_CHSF;
+	    break;
+#ifndef USE_AMFP
+	case AM_FADD:
+	    k = K_FADD;
+	    z = SZ_F;
+	    break;
+	case AM_FSUB:
+	    k = K_FSUB;
+	    z = SZ_F;
+	    break;
+	case AM_FMUL:
+	    k = K_FMUL;
+	    z = SZ_F;
+	    break;
+	case AM_FDIV:
+	    k = K_FDIV;
+	    z = SZ_F;
+	    break;
+#endif
+	case AM_PTO:
+	    k = K_PTO;
+	    break;
+	case AM_POP:
+	    k = K_POP;
+	    break;
+	case AM_XCH:
+	    k = K_XCH;
+	    break;
+	case AM_PUPI:
+	    k = K_PUPI;
+	    break;
+	}
+	ab_kern[i] = k;
+	ab_szk[i] = z;
+    }
+}
+
+
+/* Gather n (2 or 4) byte operand at stack offset off, for the k chips
+ * in the pass
+ */
+AB_INLINE void ab_ld(struct ab_bank *bk, int k, int off, int n, uint32 *v) {
+    unsigned char *p;
+    int j, c;
+
+    for (j = 0; j < k; ++j) {
+	c = bk->lane[j];
+	p = bk->stack[c] + ((bk->sp[c] + off) & 0xf);
+	v[j] = p[0] | ((uint32)p[1] << 8);
+	if (n == 4)
+	    v[j] |= ((uint32)p[2] << 16) | ((uint32)p[3] << 24);
+    }
+}
+
+
+/* Scatter n byte result to stack offset off (both copies)
+ */
+AB_INLINE void ab_st(struct ab_bank *bk, int k, int off, int n, uint32 *v) {
+    unsigned char *s, t[4];
+    int i, j, c, q;
+
+    for (j = 0; j < k; ++j) {
+	c = bk->lane[j];
+	s = bk->stack[c];
+	q = (bk->sp[c] + off) & 0xf;
+	t[0] = v[j];
+	t[1] = v[j] >> 8;
+	t[2] = v[j] >> 16;
+	t[3] = v[j] >> 24;
+	if (q + n <= 16) {
+	    memcpy(s + q, t, n);
+	    memcpy(s + q + 16, t, n);
+	} else
+	    for (i = 0; i < n; ++i, q = (q + 1) & 0xf)
+		s[q] = s[q + 16] = t[i];
+    }
+}
+
+
+/* AM9511 float to IEEE bits (am_fp() then fp_ie())
+ */
+AB_INLINE void ab_unpk(int k, uint32 *v, float *f) {
+    uint32 e, u[AB_CHUNK];
+    int j;
+
+    for (j = 0; j < k; ++j) {
+	e = (v[j] >> 24) & 0x7f;
+	e = (e ^ 0x40) + 62;               /* 7 bit 2's comp, +126 */
+	u[j] = (v[j] & 0x80000000) | (e << 23) | (v[j] & 0x7fffff);
+	u[j] = (v[j] & 0x800000) ? u[j] : 0;
+    }
+    memcpy(f, u, k * sizeof (float));
+}
+
+
+/* basicf() of am9511.c on k float results: wrap the exponent by 128 on
+ * overflow and underflow, then to AM9511 float (ie_fp() then fp_am()).
+ * Error bits are or'ed into e.
+ */
+AB_INLINE void ab_pack(int k, float *f, uint32 *v, unsigned char *e) {
+    uint32 u, x, ovf, und;
+    double m;
+    float r;
+    int j, n;
+
+    memcpy(v, f, k * sizeof (float));
+    for (j = 0; j < k; ++j) {
+	u = v[j];
+	x = (u >> 23) & 0xff;
+
+	/* frexp() exponent is x - 126
+	 */
+	ovf = (x > 189);
+	und = (x != 0) && (x < 62);
+	u = ovf ? u - (128UL << 23) : u;
+	u = und ? u + (128UL << 23) : u;
+	e[j] |= ovf ? AM_ERR_OVF : 0;
+	e[j] |= und ? AM_ERR_UND : 0;
+
+	x = (u >> 23) & 0xff;
+	v[j] = (u & 0x80000000) | (((x - 126) & 0x7f) << 24) |
+	       0x800000 | (u & 0x7fffff);
+	v[j] = ((x >= 63) && (x <= 190)) ? v[j] : 0;
+    }
+
+    /* Denormal results (product or quotient below 2^-126) are rare,
+     * and done as basicf() does them
+     */
+    for (j = 0; j < k; ++j) {
+	memcpy(&u, &f[j], 4);
+	if (((u & 0x7f800000) != 0) || ((u & 0x7fffff) == 0))
+	    continue;
+	m = frexp(f[j], &n);
+	e[j] |= AM_ERR_UND;
+	r = ldexp(m, n + 128);
+	memcpy(&u, &r, 4);
+	x = (u >> 23) & 0xff;
+	v[j] = (u & 0x80000000) | (((x - 126) & 0x7f) << 24) |
+	       0x800000 | (u & 0x7fffff);
+	v[j] = ((x >= 63) && (x <= 190)) ? v[j] : 0;
+    }
+}
+
+
+/* Run op on one chip, on the scratch am9511.c chip. The stack goes
+ * over rotated (the scratch chip ends up with sp 0), which does not
+ * change anything a command can see.
+ */
+static void ab_slow(struct ab_bank *bk, int c, unsigned char op) {
+    unsigned char *s = bk->stack[c];
+    int i;
+
+    am_reset(bk->chip);
+    for (i = 0; i < 16; ++i)
+	am_push(bk->chip, s[(bk->sp[c] + i) & 0xf]);
+    am_command(bk->chip, op);
+    bk->status[c] = am_status(bk->chip);
+    for (i = 15; i >= 0; --i)
+	s[i] = s[i + 16] = am_pop(bk->chip);
+    bk->sp[c] = 0;
+    bk->latch[c] = op;
+}
+
+
+/* Move the k chips' stack pointers by d, and set status: e, and SIGN
+ * and ZERO from the new top of stack
+ */
+AB_INLINE void ab_fin(struct ab_bank *bk, int k, int d, unsigned char op) {
+    unsigned char *t, s;
+    int j, c;
+
+    for (j = 0; j < k; ++j) {
+	c = bk->lane[j];
+	bk->sp[c] = (bk->sp[c] + d) & 0xf;
+	t = bk->stack[c] + ((bk->sp[c] - 4) & 0xf);
+	s = bk->e[j];
+	switch (ab_szk[op]) {
+	case SZ_S:
+	    if ((t[3] | t[2]) == 0)
+		s |= AM_ZERO;
+	    break;
+	case SZ_D:
+	    if ((t[3] | t[2] | t[1] | t[0]) == 0)
+		s |= AM_ZERO;
+	    break;
+	case SZ_F:
+	    if ((t[2] & 0x80) == 0)
+		s |= AM_ZERO;
+	    break;
+	}
+	if ((ab_szk[op] != SZ_NONE) && (t[3] & 0x80))
+	    s |= AM_SIGN;
+	bk->status[c] = s;
+	bk->latch[c] = op;
+    }
+}
+
+
+/* One pass of op over the k chips in bk->lane[]
+ */
+AB_INLINE void ab_kpass(struct ab_bank *bk, int k, unsigned char op) {
+    uint32 *a = bk->a, *b = bk->b, *r = bk->r;
+    float *fa = bk->fa, *fb = bk->fb, *fr = bk->fr;
+    unsigned char *e = bk->e;
+    int j, w, d = 0;
+
+    w = ((op & AM_SINGLE) == AM_SINGLE) ? 2 : 4;
+    memset(e, 0, k);
+
+    switch (ab_kern[op]) {
+    case K_SLOW:
+	for (j = 0; j < k; ++j)
+	    ab_slow(bk, bk->lane[j], op);
+	return;
+
+    case K_NOP:
+	break;
+
+    /* sadd() dadd() ssub() dsub() of ova.c: carry (borrow) and
+     * overflow from the signs
+     */
+    case K_ADD16:
+    case K_SUB16:
+	ab_ld(bk, k, -4, 2, a);
+	ab_ld(bk, k, -2, 2, b);
+	if (ab_kern[op] == K_ADD16)
+	    for (j = 0; j < k; ++j) {
+		r[j] = (a[j] + b[j]) & 0xffff;
+		e[j] = ((r[j] < a[j]) ? AM_CARRY : 0) |
+		       ((~(a[j] ^ b[j]) & (a[j] ^ r[j]) & 0x8000) ?
+			AM_ERR_OVF : 0);
+	    }
+	else
+	    for (j = 0; j < k; ++j) {
+		r[j] = (a[j] - b[j]) & 0xffff;
+		e[j] = ((a[j] < b[j]) ? AM_CARRY : 0) |
+		       (((a[j] ^ b[j]) & (a[j] ^ r[j]) & 0x8000) ?
+			AM_ERR_OVF : 0);
+	    }
+	ab_st(bk, k, -4, 2, r);
+	d = -2;
+	break;
+
+    case K_ADD32:
+    case K_SUB32:
+	ab_ld(bk, k, -8, 4, a);
+	ab_ld(bk, k, -4, 4, b);
+	if (ab_kern[op] == K_ADD32)
+	    for (j = 0; j < k; ++j) {
+		r[j] = a[j] + b[j];
+		e[j] = ((r[j] < a[j]) ? AM_CARRY : 0) |
+		       ((~(a[j] ^ b[j]) & (a[j] ^ r[j]) & 0x80000000) ?
+			AM_ERR_OVF : 0);
+	    }
+	else
+	    for (j = 0; j < k; ++j) {
+		r[j] = a[j] - b[j];
+		e[j] = ((a[j] < b[j]) ? AM_CARRY : 0) |
+		       (((a[j] ^ b[j]) & (a[j] ^ r[j]) & 0x80000000) ?
+			AM_ERR_OVF : 0);
+	    }
+	ab_st(bk, k, -8, 4, r);
+	d = -4;
+	break;
+
+    /* cm16() and cm32(): the most negative number is left alone, and
+     * is an overflow
+     */
+    case K_CHS16:
+	ab_ld(bk, k, -2, 2, a);
+	for (j = 0; j < k; ++j) {
+	    r[j] = (a[j] == 0x8000) ? a[j] : ((0 - a[j]) & 0xffff);
+	    e[j] = (a[j] == 0x8000) ? AM_ERR_OVF : 0;
+	}
+	ab_st(bk, k, -2, 2, r);
+	break;
+
+    case K_CHS32:
+	ab_ld(bk, k, -4, 4, a);
+	for (j = 0; j < k; ++j) {
+	    r[j] = (a[j] == 0x80000000) ? a[j] : (0 - a[j]);
+	    e[j] = (a[j] == 0x80000000) ? AM_ERR_OVF : 0;
+	}
+	ab_st(bk, k, -4, 4, r);
+	break;
+
+    case K_CHSF:
+	ab_ld(bk, k, -4, 4, a);
+	for (j = 0; j < k; ++j)
+	    r[j] = (a[j] & 0x800000) ? (a[j] ^ 0x80000000) : a[j];
+	ab_st(bk, k, -4, 4, r);
+	break;
+
+    /* FADD FSUB FMUL FDIV, as basicf(). a is NOS, b is TOS.
+     */
+    case K_FADD:
+    case K_FSUB:
+    case K_FMUL:
+    case K_FDIV:
+	ab_ld(bk, k, -8, 4, a);
+	ab_ld(bk, k, -4, 4, b);
+	ab_unpk(k, a, fa);
+	ab_unpk(k, b, fb);
+	switch (ab_kern[op]) {
+	case K_FADD:
+	    for (j = 0; j < k; ++j)
+		fr[j] = fa[j] + fb[j];
+	    break;
+	case K_FSUB:
+	    for (j = 0; j < k; ++j)
+		fr[j] = fa[j] - fb[j];
+	    break;
+	case K_FMUL:
+	    for (j = 0; j < k; ++j)
+		fr[j] = fa[j] * fb[j];
+	    break;
+	case K_FDIV:
+	    for (j = 0; j < k; ++j) {
+		e[j] = (fb[j] == 0.0) ? AM_ERR_DIV0 : 0;
+		fr[j] = (fb[j] == 0.0) ? fa[j] : fa[j] / fb[j];
+	    }
+	    break;
+	}
+	ab_pack(k, fr, r, e);
+	ab_st(bk, k, -8, 4, r);
+	d = -4;
+	break;
+
+    case K_PTO:
+	ab_ld(bk, k, -w, w, a);
+	ab_st(bk, k, 0, w, a);
+	d = w;
+	break;
+
+    case K_POP:
+	d = -w;
+	break;
+
+    case K_XCH:
+	ab_ld(bk, k, -2 * w, w, a);
+	ab_ld(bk, k, -w, w, b);
+	ab_st(bk, k, -2 * w, w, b);
+	ab_st(bk, k, -w, w, a);
+	break;
+
+    case K_PUPI:
+	for (j = 0; j < k; ++j)
+	    r[j] = AM_PI_W;
+	ab_st(bk, k, 0, 4, r);
+	d = 4;
+	break;
+    }
+
+    ab_fin(bk, k, d, op);
+}
+
+
+static void ab_pass_sc(struct ab_bank *bk, int k, unsigned char op) {
+    ab_kpass(bk, k, op);
+}
+
+#ifdef AB_X86
+__attribute__((target("avx2")))
+static void ab_pass_a2(struct ab_bank *bk, int k, unsigned char op) {
+    ab_kpass(bk, k, op);
+}
+#endif
+
+
+/* Build the tables and pick the pass, the first time a bank is made.
+ * Banks may be made by several threads at once: one builds, and the
+ * others wait for it (as am_ops_init() in am9511.c).
+ */
+static void ab_init(void) {
+    int s = 0;
+
+    if (__atomic_load_n(&ab_opinit, __ATOMIC_ACQUIRE) == 2)
+	return;
+    if (__atomic_compare_exchange_n(&ab_opinit, &s, 1, 0,
+				    __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+	ab_mkops();
+	ab_pass = ab_pass_sc;
+#ifdef AB_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	    ab_pass = ab_pass_a2;
+#endif
+	__atomic_store_n(&ab_opinit, 2, __ATOMIC_RELEASE);
+	return;
+    }
+    while (__atomic_load_n(&ab_opinit, __ATOMIC_ACQUIRE) != 2)
+	;
+}
+
+
+/* Run op on the m chips of commands cmd[ix[0..m-1]]
+ */
+static void ab_group(struct ab_bank *bk, struct ab_cmd *cmd, int *ix,
+		     int m, unsigned char op, unsigned char *status) {
+    int i, j, k;
+
+    for (i = 0; i < m; i += k) {
+	k = m - i;
+	if (k > AB_CHUNK)
+	    k = AB_CHUNK;
+	for (j = 0; j < k; ++j)
+	    bk->lane[j] = cmd[ix[i + j]].chip;
+	(*ab_pass)(bk, k, op);
+	if (status != NULL)
+	    for (j = 0; j < k; ++j)
+		status[ix[i + j]] = bk->status[bk->lane[j]];
+    }
+}
+
+
+/* Make room for n commands in ab_run(). Returns 0 if out of memory.
+ */
+static int ab_room(struct ab_bank *bk, int n) {
+    int *rn, *iy, *ix;
+
+    if (n <= bk->cap)
+	return 1;
+    rn = realloc(bk->rn, (n + 1) * sizeof (int));
+    if (rn != NULL)
+	bk->rn = rn;
+    iy = realloc(bk->iy, n * sizeof (int));
+    if (iy != NULL)
+	bk->iy = iy;
+    ix = realloc(bk->ix, n * sizeof (int));
+    if (ix != NULL)
+	bk->ix = ix;
+    if ((rn == NULL) || (iy == NULL) || (ix == NULL))
+	return 0;
+    bk->cap = n;
+    return 1;
+}
+
+
+/* Run n commands. If status is not NULL, status[i] gets the status
+ * after cmd[i]. Returns -1 if out of memory (and nothing is done).
+ */
+int ab_run(void *bp, struct ab_cmd *cmd, int n, unsigned char *status) {
+    struct ab_bank *bk = (struct ab_bank *)bp;
+    int cnt[257];
+    int *rn, *iy, *ix;
+    int i, r, nr, s, e, op;
+
+    if (!ab_room(bk, n))
+	return -1;
+    rn = bk->rn;
+    iy = bk->iy;
+    ix = bk->ix;
+
+    /* Round of each command, and commands in round order (counting
+     * sort, starts of rounds in rn[] after the commands' rounds are
+     * used)
+     */
+    nr = 0;
+    for (i = 0; i < n; ++i) {
+	r = bk->round[cmd[i].chip]++;
+	if (r >= nr)
+	    nr = r + 1;
+	iy[i] = r;
+    }
+    for (i = 0; i < n; ++i)
+	bk->round[cmd[i].chip] = 0;
+    if (nr == 1) {
+	rn[0] = n;
+	for (i = 0; i < n; ++i)
+	    iy[i] = i;
+    } else {
+	for (r = 0; r <= nr; ++r)
+	    rn[r] = 0;
+	for (i = 0; i < n; ++i)
+	    ++rn[iy[i] + 1];
+	for (r = 0; r < nr; ++r)
+	    rn[r + 1] += rn[r];
+	for (i = 0; i < n; ++i)
+	    ix[rn[iy[i]]++] = i;
+	for (i = 0; i < n; ++i)
+	    iy[i] = ix[i];
+    }
+
+    /* Each round, in opcode order. A round of one opcode (the usual
+     * case) needs no sort.
+     */
+    for (r = 0, s = 0; r < nr; ++r, s = e) {
+	e = rn[r];
+	op = cmd[iy[s]].op;
+	for (i = s + 1; (i < e) && (cmd[iy[i]].op == op); ++i)
+	    ;
+	if (i == e) {
+	    ab_group(bk, cmd, iy + s, e - s, op, status);
+	    continue;
+	}
+	for (op = 0; op < 257; ++op)
+	    cnt[op] = 0;
+	cnt[0] = s;
+	for (i = s; i < e; ++i)
+	    ++cnt[cmd[iy[i]].op + 1];
+	for (op = 0; op < 256; ++op)
+	    cnt[op + 1] += cnt[op];
+	for (i = s; i < e; ++i)
+	    ix[cnt[cmd[iy[i]].op]++] = iy[i];
+
+	/* cnt[op] is now the end of op's commands
+	 */
+	for (op = 0, i = s; op < 256; ++op) {
+	    if (cnt[op] > i)
+		ab_group(bk, cmd, ix + i, cnt[op] - i, op, status);
+	    i = cnt[op];
+	}
+    }
+    return 0;
+}
+
+
+/* Create bank of n chips
+ */
+void *ab_create(int n) {
+    struct ab_bank *bk;
+    int i;
+
+    bk = calloc(1, sizeof (struct ab_bank));
+    if (bk == NULL)
+	return NULL;
+    bk->n = n;
+    bk->stack = malloc(n * sizeof (*bk->stack));
+    bk->sp = malloc(n);
+    bk->status = malloc(n);
+    bk->latch = malloc(n);
+    bk->round = calloc(n, sizeof (int));
+    bk->chip = am_create(-1, -1);
+    if ((bk->stack == NULL) || (bk->sp == NULL) || (bk->status == NULL) ||
+	(bk->latch == NULL) || (bk->round == NULL) || (bk->chip == NULL) ||
+	!ab_room(bk, n)) {
+	ab_destroy(bk);
+	return NULL;
+    }
+    ab_init();
+    for (i = 0; i < n; ++i)
+	ab_reset(bk, i);
+    return bk;
+}
+
+
+/* Free bank
+ */
+void ab_destroy(void *bp) {
+    struct ab_bank *bk = (struct ab_bank *)bp;
+
+    if (bk == NULL)
+	return;
+    free(bk->stack);
+    free(bk->sp);
+    free(bk->status);
+    free(bk->latch);
+    free(bk->round);
+    free(bk->rn);
+    free(bk->iy);
+    free(bk->ix);
+    am_destroy(bk->chip);
+    free(bk);
+}
+
+
+/* Reset one chip
+ */
+void ab_reset(void *bp, int c) {
+    struct ab_bank *bk = (struct ab_bank *)bp;
+
+    memset(bk->stack[c], 0, 32);
+    bk->sp[c] = 0;
+    bk->status[c] = 0;
+    bk->latch[c] = 0;
+}
+
+
+/* Push byte to chip c
+ */
+void ab_push(void *bp, int c, unsigned char v) {
+    struct ab_bank *bk = (struct ab_bank *)bp;
+    int q = bk->sp[c];
+
+    bk->stack[c][q] = bk->stack[c][q + 16] = v;
+    bk->sp[c] = (q + 1) & 0xf;
+}
+
+
+/* Pop byte from chip c
+ */
+unsigned char ab_pop(void *bp, int c) {
+    struct ab_bank *bk = (struct ab_bank *)bp;
+
+    bk->sp[c] = (bk->sp[c] - 1) & 0xf;
+    return bk->stack[c][bk->sp[c]];
+}
+
+
+/* Status of chip c
+ */
+unsigned char ab_status(void *bp, int c) {
+    struct ab_bank *bk = (struct ab_bank *)bp;
+
+    return bk->status[c];
+}
@@ -0,0 +1,24 @@
+/* ambank.h
+ *
+ * Bank of AM9511 chips, stepped together (host only).
+ */
+
+#ifndef _AMBANK_H
+#define _AMBANK_H
+
+/* One command for ab_run(): chip number in the bank, and opcode.
+ */
+struct ab_cmd {
+    int chip;
+    unsigned char op;
+};
+
+void         *ab_create(int n);
+void          ab_destroy(void *);
+void          ab_reset(void *, int chip);
+void          ab_push(void *, int chip, unsigned char);
+unsigned char ab_pop(void *, int chip);
+unsigned char ab_status(void *, int chip);
+int           ab_run(void *, struct ab_cmd *, int n, unsigned char *status);
+
+#endif
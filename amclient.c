@@ -0,0 +1,259 @@
+/* amclient.c
+ *
+ * AM9511 through the daemon (amd.c). Link with this instead of
+ * am9511.c (as with hw9511.c for the real chip) to use a chip of the
+ * daemon's, through shared memory (see amshm.h). Host only, Linux.
+ *
+ * am_create() claims a slot (and its chip) in the segment AS_NAME,
+ * or $AM9511_SHM. am_push() and am_command() put their byte on the
+ * command ring, and return at once. am_pop() waits for its byte on
+ * the result ring: it spins for a while (not on a single CPU), then
+ * sleeps on the futex. am_status() does not wait: it reads AM_BUSY
+ * until the daemon has caught up, as the real chip is busy while it
+ * works (on a single CPU, it yields to the daemon first, as a guest
+ * polling status would otherwise keep it from running).
+ *
+ * If the daemon goes away, am_pop() returns 0 and am_status() reads
+ * AM_ERR_MASK, after saying so once on stderr.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "am9511.h"
+#include "amshm.h"
+#include "types.h"
+
+
+#define AC_SPIN  1024      /* spins before sleeping (SMP) */
+#define AC_NAP   1000      /* sleep, ms, between looks at the daemon */
+#define AC_BUSY  65536     /* AM_BUSY reads between looks at the daemon */
+
+
+struct am9511 {
+    struct as_slot *s;
+};
+
+static struct as_hdr *hdr = NULL;
+static int spin;
+static int gone = 0;
+static unsigned long busy = 0;
+
+
+/* Map the daemon's segment. Returns 0 if it is not there.
+ */
+static int attach(void) {
+    struct stat st;
+    struct as_hdr *h;
+    char *name;
+    int fd;
+
+    if (hdr != NULL)
+	return 1;
+    name = getenv("AM9511_SHM");
+    if (name == NULL)
+	name = AS_NAME;
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0)
+	return 0;
+    if ((fstat(fd, &st) != 0) || (st.st_size < (off_t)AS_BYTES(0))) {
+	close(fd);
+	return 0;
+    }
+    h = (struct as_hdr *)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE,
+			      MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED)
+	return 0;
+    if ((AS_LD(&h->magic) != AS_MAGIC) || (h->version != AS_VERSION) ||
+	((off_t)AS_BYTES(h->nslot) > st.st_size)) {
+	munmap(h, st.st_size);
+	return 0;
+    }
+    spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? AC_SPIN : 0;
+    hdr = h;
+    return 1;
+}
+
+
+/* Check the daemon is still there
+ */
+static int alive(void) {
+    if (!gone && (kill(hdr->pid, 0) != 0) && (errno == ESRCH)) {
+	fprintf(stderr, "am9511 daemon gone\n");
+	gone = 1;
+    }
+    return !gone;
+}
+
+
+/* Put m on the command ring, and ring the bell if the daemon sleeps
+ */
+static void put(struct as_slot *s, unsigned m) {
+    struct as_ring *r = &s->cmd;
+    uint32 t = r->tail;
+
+    while (t - r->hcache == AS_SIZE) {
+	r->hcache = AS_LD(&r->head);
+	if ((t - r->hcache == AS_SIZE) && alive())
+	    usleep(10);
+	if (gone)
+	    return;
+    }
+    r->buf[t & (AS_SIZE - 1)] = m;
+    AS_STS(&r->tail, t + 1);
+    if (AS_LDS(&hdr->sleep)) {
+	__atomic_add_fetch(&hdr->bell, 1, __ATOMIC_SEQ_CST);
+	as_wake(&hdr->bell, 1);
+    }
+}
+
+
+/* Push byte to am9511 stack
+ */
+void am_push(void *p, unsigned char n) {
+    put(((struct am9511 *)p)->s, AS_PUSH | n);
+}
+
+
+/* Pop byte from am9511 stack
+ */
+unsigned char am_pop(void *p) {
+    struct as_slot *s = ((struct am9511 *)p)->s;
+    struct as_ring *r = &s->res;
+    uint32 h = r->head;
+    unsigned char b;
+    int n = 0;
+
+    if (gone)
+	return 0;
+    put(s, AS_POP);
+    while (h == (r->tcache = AS_LD(&r->tail))) {
+	if (n < spin) {
+#if defined(__x86_64__) || defined(__i386__)
+	    __builtin_ia32_pause();
+#endif
+	    ++n;
+	    continue;
+	}
+	AS_STS(&r->wait, 1);
+	if ((AS_LDS(&r->tail) == h) &&
+	    (as_sleep(&r->tail, h, AC_NAP) != 0) && (errno == ETIMEDOUT) &&
+	    !alive())
+	    return 0;
+	AS_STS(&r->wait, 0);
+    }
+    b = r->buf[h & (AS_SIZE - 1)];
+    AS_ST(&r->head, h + 1);
+    return b;
+}
+
+
+/* Return am9511 status
+ */
+unsigned char am_status(void *p) {
+    struct as_ring *r = &((struct am9511 *)p)->s->cmd;
+
+    if (gone)
+	return AM_ERR_MASK;
+    if (AS_LD(&r->head) != r->tail) {
+	if (spin == 0)
+	    sched_yield();
+	if ((++busy % AC_BUSY == 0) && !alive())
+	    return AM_ERR_MASK;
+	return AM_BUSY;
+    }
+    return __atomic_load_n(&r->stat, __ATOMIC_RELAXED);
+}
+
+
+/* Send command to am9511
+ */
+void am_command(void *p, unsigned char n) {
+    put(((struct am9511 *)p)->s, AS_CMD | n);
+}
+
+
+/* Reset am9511
+ */
+void am_reset(void *p) {
+    put(((struct am9511 *)p)->s, AS_RESET);
+}
+
+
+/* Dump am9511 stack (the stack is in the daemon)
+ */
+void am_dump(void *p, unsigned char op) {
+    op = op;
+    p = p;
+}
+
+
+/* Size of AM9511 access structure, for am_init()
+ */
+size_t am_size(void) {
+    return sizeof (struct am9511);
+}
+
+
+/* Claim a slot of the daemon's, for the AM9511 access structure in
+ * caller's storage. status and data (ports) are not used. Returns
+ * NULL if there is no daemon, or no free slot.
+ */
+void *am_init(void *storage, int status, int data) {
+    struct am9511 *p = (struct am9511 *)storage;
+    struct as_slot *s;
+    uint32 i, f, pid;
+
+    status = status;
+    data = data;
+    if (!attach())
+	return NULL;
+    pid = (uint32)getpid();
+    for (i = 0; i < hdr->nslot; ++i) {
+	s = AS_SLOT(hdr, i);
+	f = AS_FREE;
+	if (__atomic_compare_exchange_n(&s->state, &f, pid, 0,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	    break;
+    }
+    if (i == hdr->nslot)
+	return NULL;
+    s->cmd.hcache = AS_LD(&s->cmd.head);
+    s->res.tcache = AS_LD(&s->res.head);
+    __atomic_store_n(&s->res.wait, 0, __ATOMIC_RELAXED);
+    p->s = s;
+    put(s, AS_OPEN);
+    return p;
+}
+
+
+/* Create AM9511 access structure
+ */
+void *am_create(int status, int data) {
+    void *p;
+
+    p = malloc(am_size());
+    if (p == NULL)
+	return NULL;
+    if (am_init(p, status, data) == NULL) {
+	free(p);
+	return NULL;
+    }
+    return p;
+}
+
+
+/* Give the slot back to the daemon, and free the access structure
+ */
+void am_destroy(void *p) {
+    put(((struct am9511 *)p)->s, AS_CLOSE);
+    free(p);
+}
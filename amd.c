@@ -0,0 +1,305 @@
+/* amd.c
+ *
+ * AM9511 daemon: a pool of chips, served to other processes through
+ * shared memory (host only, Linux). See amshm.h for the layout, and
+ * amclient.c for the client side, which emulators link instead of
+ * am9511.c (as they would hw9511.c for the real chip).
+ *
+ *   amd [-n slots] [-s name] [-m mode]
+ *
+ * One thread serves every slot: it takes whatever each client has put
+ * on its command ring, runs it on the slot's chip, and puts popped
+ * bytes on the result ring. When there is nothing to do, it spins for
+ * a while (not on a single CPU), then sleeps on the bell futex. About
+ * once a second, it frees the slots of clients that died without
+ * giving them up. SIGINT or SIGTERM remove the segment and stop.
+ *
+ * The segment is made with mode 0600 (-m for others): any process that
+ * can write it can take and use the chips. The daemon keeps its own
+ * count of slots, and does not trust the header for it. It will not
+ * start over a segment whose daemon is still running.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "am9511.h"
+#include "amshm.h"
+#include "types.h"
+
+
+#define AD_SPIN  4096      /* empty scans before sleeping (SMP) */
+#define AD_NAP   1000      /* sleep, ms, between looks for dead clients */
+#define AD_BUSY  65536     /* busy scans between looks at the clock */
+#define AD_MODE  0600      /* default segment mode */
+
+
+static struct as_hdr *hdr;
+static uint32 nslot;
+static void **chips;
+static volatile sig_atomic_t stop;
+
+
+static void onsig(int sig) {
+    stop = sig;
+}
+
+
+/* Put popped byte b on the result ring of slot s, and wake the
+ * client if it sleeps. The client has one pop out at a time, so the
+ * ring is never full.
+ */
+static void put(struct as_slot *s, unsigned char b) {
+    struct as_ring *r = &s->res;
+    uint32 t = r->tail;
+
+    r->buf[t & (AS_SIZE - 1)] = b;
+    AS_STS(&r->tail, t + 1);
+    if (AS_LDS(&r->wait))
+	as_wake(&r->tail, 1);
+}
+
+
+/* Do what slot i has on its command ring. Returns 1 if there was
+ * anything.
+ */
+static int serve(int i) {
+    struct as_slot *s = AS_SLOT(hdr, i);
+    struct as_ring *r = &s->cmd;
+    void *am9511 = chips[i];
+    uint32 h = r->head, t;
+    unsigned m;
+    int bye = 0;
+
+    t = AS_LD(&r->tail);
+    if (h == t)
+	return 0;
+    for (; h != t; ++h) {
+	m = r->buf[h & (AS_SIZE - 1)];
+	switch (m & AS_KIND) {
+	case AS_PUSH:
+	    am_push(am9511, m);
+	    break;
+	case AS_CMD:
+	    am_command(am9511, m);
+	    break;
+	case AS_POP:
+	    put(s, am_pop(am9511));
+	    break;
+	case AS_RESET:
+	case AS_OPEN:
+	    am_reset(am9511);
+	    break;
+	case AS_CLOSE:
+	    bye = 1;
+	    break;
+	}
+    }
+    __atomic_store_n(&r->stat, am_status(am9511), __ATOMIC_RELAXED);
+    AS_ST(&r->head, t);
+    if (bye) {
+	am_reset(am9511);
+	AS_ST(&s->state, AS_FREE);
+    }
+    return 1;
+}
+
+
+/* Is the process gone? (pid 0 or less is no process)
+ */
+static int dead(int32 pid) {
+    return (pid <= 0) || ((kill(pid, 0) != 0) && (errno == ESRCH));
+}
+
+
+/* Free the slots of clients that are gone, if a second has passed
+ * since the last look. What they left on the rings is dropped.
+ */
+static void reap(void) {
+    static time_t last = 0;
+    struct as_slot *s;
+    uint32 i, st;
+
+    if (time(NULL) == last)
+	return;
+    last = time(NULL);
+    for (i = 0; i < nslot; ++i) {
+	s = AS_SLOT(hdr, i);
+	st = AS_LD(&s->state);
+	if ((st == AS_FREE) || !dead((int32)st))
+	    continue;
+	AS_ST(&s->cmd.head, AS_LD(&s->cmd.tail));
+	AS_ST(&s->res.head, AS_LD(&s->res.tail));
+	am_reset(chips[i]);
+	AS_ST(&s->state, AS_FREE);
+    }
+}
+
+
+/* Is there a daemon at name already? A segment left by one that is
+ * gone is removed.
+ */
+static int running(char *name) {
+    struct as_hdr *h;
+    struct stat st;
+    int fd, r = 0;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+	return 0;
+    if ((fstat(fd, &st) == 0) && (st.st_size >= (off_t)sizeof (*h))) {
+	h = (struct as_hdr *)mmap(NULL, sizeof (*h), PROT_READ, MAP_SHARED,
+				  fd, 0);
+	if (h != MAP_FAILED) {
+	    r = (AS_LD(&h->magic) == AS_MAGIC) && !dead(h->pid);
+	    munmap(h, sizeof (*h));
+	}
+    }
+    close(fd);
+    if (!r)
+	shm_unlink(name);
+    return r;
+}
+
+
+static void usage(char *p) {
+    printf("usage: %s [-n slots] [-s name] [-m mode]\n", p);
+    printf("    -n slots  chips, and clients at a time (default %d)\n",
+	   AS_SLOTS);
+    printf("    -s name   shared memory name (default %s)\n", AS_NAME);
+    printf("    -m mode   shared memory mode, octal (default %03o)\n",
+	   AD_MODE);
+    exit(1);
+}
+
+
+int main(int ac, char **av) {
+    int ch, fd, spin, n, work;
+    long busy;
+    uint32 i, bell;
+    mode_t mode;
+    char *name;
+    struct sigaction sa;
+
+    nslot = AS_SLOTS;
+    mode = AD_MODE;
+    name = getenv("AM9511_SHM");
+    if (name == NULL)
+	name = AS_NAME;
+    while ((ch = getopt(ac, av, "n:s:m:")) != EOF)
+	switch (ch) {
+	case 'n':
+	    nslot = atoi(optarg);
+	    break;
+	case 's':
+	    name = optarg;
+	    break;
+	case 'm':
+	    mode = (mode_t)strtol(optarg, NULL, 8);
+	    break;
+	case '?':
+	default:
+	    usage(av[0]);
+	}
+    if (nslot < 1)
+	usage(av[0]);
+
+    chips = malloc(nslot * sizeof (void *));
+    if (chips == NULL) {
+	fprintf(stderr, "cannot allocate\n");
+	return 1;
+    }
+    for (i = 0; i < nslot; ++i) {
+	chips[i] = am_create(-1, -1);
+	if (chips[i] == NULL) {
+	    fprintf(stderr, "cannot create chip\n");
+	    return 1;
+	}
+    }
+
+    if (running(name)) {
+	fprintf(stderr, "%s: a daemon is running at %s\n", av[0], name);
+	return 1;
+    }
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+    if ((fd >= 0) && (fchmod(fd, mode) != 0)) {
+	close(fd);
+	fd = -1;
+    }
+    if ((fd < 0) || (ftruncate(fd, AS_BYTES(nslot)) != 0)) {
+	perror(name);
+	return 1;
+    }
+    hdr = (struct as_hdr *)mmap(NULL, AS_BYTES(nslot),
+				PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+	perror("mmap");
+	return 1;
+    }
+    memset(hdr, 0, AS_BYTES(nslot));
+    hdr->version = AS_VERSION;
+    hdr->nslot = nslot;
+    hdr->pid = getpid();
+    for (i = 0; i < nslot; ++i)
+	AS_SLOT(hdr, i)->cmd.stat = am_status(chips[i]);
+    AS_ST(&hdr->magic, AS_MAGIC);
+
+    memset(&sa, 0, sizeof (sa));
+    sa.sa_handler = onsig;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1) ? AD_SPIN : 0;
+    printf("%s: %u chips at %s\n", av[0], nslot, name);
+    fflush(stdout);
+
+    n = 0;
+    busy = 0;
+    while (!stop) {
+	work = 0;
+	for (i = 0; i < nslot; ++i)
+	    if (AS_LD(&AS_SLOT(hdr, i)->state) != AS_FREE)
+		work |= serve(i);
+	if (work) {
+	    n = 0;
+	    if (++busy % AD_BUSY == 0)
+		reap();
+	    continue;
+	}
+	if (n < spin) {
+#if defined(__x86_64__) || defined(__i386__)
+	    __builtin_ia32_pause();
+#endif
+	    ++n;
+	    continue;
+	}
+
+	/* Nothing for a while: sleep, unless a client put something
+	 * after the scan (it saw sleep 0), or rings after this
+	 */
+	reap();
+	bell = AS_LD(&hdr->bell);
+	AS_STS(&hdr->sleep, 1);
+	for (i = 0; i < nslot; ++i)
+	    if ((AS_LD(&AS_SLOT(hdr, i)->state) != AS_FREE) &&
+		(AS_LDS(&AS_SLOT(hdr, i)->cmd.tail) !=
+		 AS_SLOT(hdr, i)->cmd.head))
+		break;
+	if (i == nslot)
+	    as_sleep(&hdr->bell, bell, AD_NAP);
+	AS_STS(&hdr->sleep, 0);
+    }
+
+    shm_unlink(name);
+    printf("%s: stopped\n", av[0]);
+    return 0;
+}
@@ -0,0 +1,448 @@
+/* amfarm.c
+ *
+ * A farm of AM9511 chips, run by worker threads (host only, POSIX
+ * threads), for hosts with many guests, each with its own chip.
+ *
+ * Guests give work to the farm as am_exec() batches (struct af_job),
+ * with af_submit(). A chip's jobs run one at a time, in the order
+ * given. Each chip has a home worker (chip number modulo workers),
+ * and each worker is pinned to a CPU (Linux), so that a chip's
+ * context stays in the cache of one core.
+ *
+ * Each worker has a deque of chips with jobs waiting. A chip is put
+ * on its home deque when it gets a job while it has none, and stays
+ * on a deque (or running) until it has none left. The owner takes
+ * chips from the top of its deque (oldest first, so that no chip
+ * waits behind a busy one), runs up to AF_QUANTUM jobs, and puts the
+ * chip back on its home deque if it has more. A worker whose deque is
+ * empty steals from the bottom of another's, and the chip goes home
+ * again after its quantum. Idle workers sleep, and are woken when
+ * their deque gets a chip, or (to steal) when a busy worker's deque
+ * gets one.
+ *
+ * Each deque has its own lock, which is only contended by a submit
+ * to that worker's chips, or a steal.
+ */
+
+#define _GNU_SOURCE         /* pthread_setaffinity_np() */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "am9511.h"
+#include "amfarm.h"
+
+
+#define AF_LINE    64       /* cache line bytes */
+#define AF_QUANTUM 8        /* jobs per turn of a chip */
+#define AF_NAP     10000000 /* idle worker looks for work to steal, ns */
+
+#define AF_IDLE    0        /* chip has no jobs */
+#define AF_READY   1        /* chip is on a deque, or running */
+
+#define ld_rlx(p)    __atomic_load_n(p, __ATOMIC_RELAXED)
+#define st_rlx(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+
+
+struct af_chip {
+    void *am9511;
+    int home;               /* worker */
+    int state;              /* AF_IDLE or AF_READY */
+    struct af_job *head;    /* jobs waiting */
+    struct af_job *tail;
+    pthread_mutex_t lock;
+} __attribute__((aligned(AF_LINE)));
+
+struct af_farm;
+
+struct af_shard {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct af_chip **dq;    /* deque, dq[top % cap] .. dq[(bot - 1) % cap] */
+    unsigned long top;
+    unsigned long bot;
+    int sleeping;
+    int id;
+    struct af_farm *farm;
+    pthread_t thr;
+} __attribute__((aligned(AF_LINE)));
+
+struct af_farm {
+    struct af_shard *sh;
+    int nw;                 /* workers */
+    int nsh;                /* shards set up */
+    int nthr;               /* workers started */
+    struct af_chip *chip;
+    int nchip;
+    int cap;                /* chips */
+    int stop;
+    unsigned long steals;
+    long pending;           /* jobs submitted, not done */
+    int nwait;              /* threads in af_wait() or af_drain() */
+    pthread_mutex_t dlock;
+    pthread_cond_t dcond;   /* a job was done */
+};
+
+
+/* Put chip c on its home deque, and wake a worker to run it: the
+ * owner if it sleeps, else one that sleeps, to steal.
+ */
+static void af_push(struct af_farm *f, struct af_chip *c) {
+    struct af_shard *s = &f->sh[c->home];
+    int i, sleeping;
+
+    pthread_mutex_lock(&s->lock);
+    s->dq[s->bot % f->cap] = c;
+    st_rlx(&s->bot, s->bot + 1);
+    sleeping = s->sleeping;
+    if (sleeping) {
+	st_rlx(&s->sleeping, 0);        /* one wake is enough */
+	pthread_cond_signal(&s->wake);
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (sleeping)
+	return;
+    for (i = 1; i < f->nw; ++i) {
+	s = &f->sh[(c->home + i) % f->nw];
+	if (ld_rlx(&s->sleeping)) {
+	    pthread_mutex_lock(&s->lock);
+	    sleeping = s->sleeping;
+	    if (sleeping) {
+		st_rlx(&s->sleeping, 0);
+		pthread_cond_signal(&s->wake);
+	    }
+	    pthread_mutex_unlock(&s->lock);
+	    if (sleeping)
+		return;
+	}
+    }
+}
+
+
+/* Take the chip at the top of s's deque (owner), or NULL
+ */
+static struct af_chip *af_take(struct af_farm *f, struct af_shard *s) {
+    struct af_chip *c = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->top != s->bot) {
+	c = s->dq[s->top % f->cap];
+	st_rlx(&s->top, s->top + 1);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return c;
+}
+
+
+/* Steal the chip at the bottom of another worker's deque, or NULL.
+ * Deques are peeked at without the lock, and only locked if they
+ * look to have a chip.
+ */
+static struct af_chip *af_steal(struct af_farm *f, struct af_shard *s) {
+    struct af_shard *v;
+    struct af_chip *c;
+    int i;
+
+    for (i = 1; i < f->nw; ++i) {
+	v = &f->sh[(s->id + i) % f->nw];
+	if (ld_rlx(&v->bot) == ld_rlx(&v->top))
+	    continue;
+	c = NULL;
+	pthread_mutex_lock(&v->lock);
+	if (v->top != v->bot) {
+	    st_rlx(&v->bot, v->bot - 1);
+	    c = v->dq[v->bot % f->cap];
+	}
+	pthread_mutex_unlock(&v->lock);
+	if (c != NULL) {
+	    __atomic_add_fetch(&f->steals, 1, __ATOMIC_RELAXED);
+	    return c;
+	}
+    }
+    return NULL;
+}
+
+
+/* Job j is done. Wake af_wait() and af_drain() if they are waiting.
+ * (done and pending are stored, and nwait loaded, sequentially
+ * consistent, against the reverse in af_wait(): one of the two sees
+ * the other.)
+ */
+static void af_finish(struct af_farm *f, struct af_job *j) {
+    __atomic_store_n(&j->done, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&f->pending, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&f->nwait, __ATOMIC_SEQ_CST)) {
+	pthread_mutex_lock(&f->dlock);
+	pthread_cond_broadcast(&f->dcond);
+	pthread_mutex_unlock(&f->dlock);
+    }
+}
+
+
+/* Run up to AF_QUANTUM jobs of chip c, then put it back home if it
+ * has more, else mark it idle.
+ */
+static void af_run(struct af_farm *f, struct af_chip *c) {
+    struct af_job *j;
+    int i;
+
+    for (i = 0; ; ++i) {
+	pthread_mutex_lock(&c->lock);
+	j = c->head;
+	if (j == NULL) {
+	    c->state = AF_IDLE;
+	    pthread_mutex_unlock(&c->lock);
+	    return;
+	}
+	if (i == AF_QUANTUM) {
+	    pthread_mutex_unlock(&c->lock);
+	    af_push(f, c);
+	    return;
+	}
+	c->head = j->next;
+	if (c->head == NULL)
+	    c->tail = NULL;
+	pthread_mutex_unlock(&c->lock);
+	j->nout = am_exec(c->am9511, j->in, j->n, j->out);
+	af_finish(f, j);
+    }
+}
+
+
+/* Worker: pin to a CPU (the id'th of those we may use, round and
+ * round), then run chips from the deque, or stolen, or sleep.
+ */
+static void *af_worker(void *arg) {
+    struct af_shard *s = (struct af_shard *)arg;
+    struct af_farm *f = s->farm;
+    struct af_chip *c;
+    struct timespec ts;
+#ifdef __linux__
+    cpu_set_t cpus;
+    int i, k;
+
+    if ((sched_getaffinity(0, sizeof (cpus), &cpus) == 0) &&
+	((k = CPU_COUNT(&cpus)) > 0)) {
+	k = s->id % k;
+	for (i = 0; i < CPU_SETSIZE; ++i)
+	    if (CPU_ISSET(i, &cpus) && (k-- == 0))
+		break;
+	CPU_ZERO(&cpus);
+	CPU_SET(i, &cpus);
+	pthread_setaffinity_np(pthread_self(), sizeof (cpus), &cpus);
+    }
+#endif
+
+    for (;;) {
+	c = af_take(f, s);
+	if (c == NULL)
+	    c = af_steal(f, s);
+	if (c != NULL) {
+	    af_run(f, c);
+	    continue;
+	}
+	pthread_mutex_lock(&s->lock);
+	if (s->top == s->bot) {
+	    if (ld_rlx(&f->stop)) {
+		pthread_mutex_unlock(&s->lock);
+		return NULL;
+	    }
+	    clock_gettime(CLOCK_REALTIME, &ts);
+	    ts.tv_nsec += AF_NAP;
+	    if (ts.tv_nsec >= 1000000000L) {
+		ts.tv_nsec -= 1000000000L;
+		++ts.tv_sec;
+	    }
+	    st_rlx(&s->sleeping, 1);
+	    pthread_cond_timedwait(&s->wake, &s->lock, &ts);
+	    st_rlx(&s->sleeping, 0);
+	}
+	pthread_mutex_unlock(&s->lock);
+    }
+}
+
+
+/* Make a farm of workers threads (one per CPU if less than 1), for
+ * up to chips chips. Returns NULL if it cannot.
+ */
+void *af_create(int workers, int chips) {
+    struct af_farm *f;
+    struct af_shard *s;
+    void *p;
+    int i;
+
+    if (workers < 1)
+	workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1)
+	workers = 1;
+    if (chips < 1)
+	chips = 1;
+    f = (struct af_farm *)calloc(1, sizeof (struct af_farm));
+    if (f == NULL)
+	return NULL;
+    f->nw = workers;
+    f->cap = chips;
+    pthread_mutex_init(&f->dlock, NULL);
+    pthread_cond_init(&f->dcond, NULL);
+    if (posix_memalign(&p, AF_LINE, chips * sizeof (struct af_chip)) != 0) {
+	free(f);
+	return NULL;
+    }
+    f->chip = (struct af_chip *)p;
+    if (posix_memalign(&p, AF_LINE, workers * sizeof (struct af_shard))
+	!= 0) {
+	free(f->chip);
+	free(f);
+	return NULL;
+    }
+    f->sh = (struct af_shard *)p;
+    memset(f->sh, 0, workers * sizeof (struct af_shard));
+    f->nsh = workers;
+    for (i = 0; i < workers; ++i) {
+	s = &f->sh[i];
+	s->id = i;
+	s->farm = f;
+	s->dq = (struct af_chip **)malloc(chips * sizeof (struct af_chip *));
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->wake, NULL);
+    }
+    for (i = 0; i < workers; ++i) {
+	if ((f->sh[i].dq == NULL) ||
+	    (pthread_create(&f->sh[i].thr, NULL, af_worker, &f->sh[i]) != 0)) {
+	    af_destroy(f);
+	    return NULL;
+	}
+	++f->nthr;
+    }
+    return f;
+}
+
+
+/* Wait for all jobs, stop the workers, and free the farm. The chips
+ * are not destroyed.
+ */
+void af_destroy(void *p) {
+    struct af_farm *f = (struct af_farm *)p;
+    struct af_shard *s;
+    int i;
+
+    af_drain(f);
+    st_rlx(&f->stop, 1);
+    for (i = 0; i < f->nthr; ++i) {
+	s = &f->sh[i];
+	pthread_mutex_lock(&s->lock);
+	pthread_cond_signal(&s->wake);
+	pthread_mutex_unlock(&s->lock);
+	pthread_join(s->thr, NULL);
+    }
+    for (i = 0; i < f->nchip; ++i)
+	pthread_mutex_destroy(&f->chip[i].lock);
+    for (i = 0; i < f->nsh; ++i) {
+	pthread_mutex_destroy(&f->sh[i].lock);
+	pthread_cond_destroy(&f->sh[i].wake);
+	free(f->sh[i].dq);
+    }
+    pthread_mutex_destroy(&f->dlock);
+    pthread_cond_destroy(&f->dcond);
+    free(f->sh);
+    free(f->chip);
+    free(f);
+}
+
+
+/* Add chip am9511 (from am_create()) to the farm. From now until
+ * af_destroy(), it must only be used through af_submit(). Returns its
+ * number in the farm, or -1 if the farm is full.
+ */
+int af_add(void *p, void *am9511) {
+    struct af_farm *f = (struct af_farm *)p;
+    struct af_chip *c;
+    int n;
+
+    pthread_mutex_lock(&f->dlock);
+    n = f->nchip;
+    if (n < f->cap)
+	++f->nchip;
+    pthread_mutex_unlock(&f->dlock);
+    if (n == f->cap)
+	return -1;
+    c = &f->chip[n];
+    c->am9511 = am9511;
+    c->home = n % f->nw;
+    c->state = AF_IDLE;
+    c->head = c->tail = NULL;
+    pthread_mutex_init(&c->lock, NULL);
+    return n;
+}
+
+
+/* Queue job j for chip number chip. j must stay put until done.
+ */
+void af_submit(void *p, int chip, struct af_job *j) {
+    struct af_farm *f = (struct af_farm *)p;
+    struct af_chip *c = &f->chip[chip];
+    int push = 0;
+
+    j->done = 0;
+    j->next = NULL;
+    __atomic_add_fetch(&f->pending, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_lock(&c->lock);
+    if (c->tail == NULL)
+	c->head = j;
+    else
+	c->tail->next = j;
+    c->tail = j;
+    if (c->state == AF_IDLE) {
+	c->state = AF_READY;
+	push = 1;
+    }
+    pthread_mutex_unlock(&c->lock);
+    if (push)
+	af_push(f, c);
+}
+
+
+/* Wait until job j is done
+ */
+void af_wait(void *p, struct af_job *j) {
+    struct af_farm *f = (struct af_farm *)p;
+
+    if (__atomic_load_n(&j->done, __ATOMIC_ACQUIRE))
+	return;
+    pthread_mutex_lock(&f->dlock);
+    __atomic_add_fetch(&f->nwait, 1, __ATOMIC_SEQ_CST);
+    while (!__atomic_load_n(&j->done, __ATOMIC_SEQ_CST))
+	pthread_cond_wait(&f->dcond, &f->dlock);
+    __atomic_sub_fetch(&f->nwait, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&f->dlock);
+}
+
+
+/* Wait until every job submitted is done. The chips may then be
+ * used directly, until the next af_submit().
+ */
+void af_drain(void *p) {
+    struct af_farm *f = (struct af_farm *)p;
+
+    if (__atomic_load_n(&f->pending, __ATOMIC_ACQUIRE) == 0)
+	return;
+    pthread_mutex_lock(&f->dlock);
+    __atomic_add_fetch(&f->nwait, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&f->pending, __ATOMIC_SEQ_CST) != 0)
+	pthread_cond_wait(&f->dcond, &f->dlock);
+    __atomic_sub_fetch(&f->nwait, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&f->dlock);
+}
+
+
+int af_workers(void *p) {
+    return ((struct af_farm *)p)->nw;
+}
+
+unsigned long af_steals(void *p) {
+    return __atomic_load_n(&((struct af_farm *)p)->steals, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,31 @@
+/* amfarm.h
+ *
+ * Farm of AM9511 chips, run by worker threads (host only).
+ */
+
+#ifndef _AMFARM_H
+#define _AMFARM_H
+
+/* One am_exec() batch for a chip in the farm. in, n and out are as
+ * for am_exec(). When the batch has run, nout is what am_exec()
+ * returned, and done is 1. next is for amfarm.c.
+ */
+struct af_job {
+    unsigned char *in;
+    int n;
+    unsigned char *out;
+    int nout;
+    int done;
+    struct af_job *next;
+};
+
+void         *af_create(int workers, int chips);
+void          af_destroy(void *);
+int           af_add(void *, void *am9511);
+void          af_submit(void *, int chip, struct af_job *);
+void          af_wait(void *, struct af_job *);
+void          af_drain(void *);
+int           af_workers(void *);
+unsigned long af_steals(void *);
+
+#endif
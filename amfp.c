@@ -0,0 +1,1071 @@
+/* amfp.c
+ *
+ * AM9511 format floating point, done with integer arithmetic only.
+ *
+ * am9511.c normally does floating point by converting the stack bytes
+ * to host float (through floatcnv), computing, and converting back.
+ * This works directly on the 24 bit mantissa and 7 bit exponent held
+ * in the stack bytes instead, as the chip does:
+ *
+ *  - results are truncated (not rounded)
+ *  - on overflow and underflow the mantissa is kept, and the exponent
+ *    wraps by 128 (and AM_ERR_OVF or AM_ERR_UND is returned)
+ *
+ * SIN COS TAN ATAN ASIN ACOS LN LOG EXP PWR reduce the argument, and
+ * then use short polynomials (small tables of Q30 coefficients), in
+ * 32 bit fixed point. SQRT is digit by digit. Results are within about
+ * 1 ulp, truncated.
+ *
+ * Enable with USE_AMFP when compiling am9511.c.
+ *
+ * Only 8, 16 and 32 bit integer operations are used, so that this can
+ * also be compiled with HI-TECH C. Like ova.c, external names are
+ * unique to 5 characters.
+ *
+ * AM9511 float (little endian, as on the stack):
+ *
+ *     p[3]       p[2]       p[1]       p[0]
+ *     s eeeeeee  1mmmmmmm   mmmmmmmm   mmmmmmmm
+ *
+ * value is 0.1mmm... x 2^e, e is 7 bit 2's complement (-64..63). If
+ * bit 23 of the mantissa is 0, the value is 0.
+ */
+
+#include <stdio.h>
+
+#include "am9511.h"
+#include "amfp.h"
+#include "types.h"
+
+
+/* Unpacked float. m is 0 for zero, otherwise 0x800000..0xffffff.
+ */
+struct af {
+    uint32 m;
+    int e;
+    unsigned char s;
+};
+
+
+/* Unpack AM9511 float
+ */
+static void unpack(unsigned char *p, struct af *a) {
+    a->s = p[3] & 0x80;
+    if ((p[2] & 0x80) == 0) {
+	a->m = 0;
+	a->e = 0;
+	return;
+    }
+    a->m = p[2];
+    a->m = (a->m << 16) | ((uint16)p[1] << 8) | p[0];
+    a->e = p[3] & 0x7f;
+    if (a->e & 0x40)
+	a->e -= 128;
+}
+
+
+/* Pack AM9511 float. Returns AM_ERR_OVF or AM_ERR_UND if the exponent
+ * had to be wrapped, otherwise AM_ERR_NONE.
+ */
+static int pack(struct af *a, unsigned char *p) {
+    int e = a->e;
+    int r = AM_ERR_NONE;
+
+    if (a->m == 0) {
+	p[0] = p[1] = p[2] = p[3] = 0;
+	return r;
+    }
+    if (e > 63) {
+	r = AM_ERR_OVF;
+	e -= 128;
+    } else if (e < -64) {
+	r = AM_ERR_UND;
+	e += 128;
+    }
+    p[0] = a->m;
+    p[1] = a->m >> 8;
+    p[2] = a->m >> 16;
+    p[3] = (e & 0x7f) | a->s;
+    return r;
+}
+
+
+/* Add magnitudes of a and b (b sign is flipped for subtract) into c.
+ *
+ * Mantissas are held with 7 guard bits (31 bits). Bits shifted out of
+ * the smaller operand are kept as a sticky bit, so that the truncated
+ * result is exact even when the signs differ.
+ */
+static void addf(struct af *a, struct af *b, struct af *c) {
+    struct af *t;
+    uint32 ma, mb, lost;
+    int d;
+
+    if (b->m == 0) {
+	*c = *a;
+	return;
+    }
+    if (a->m == 0) {
+	*c = *b;
+	return;
+    }
+
+    /* a is the operand with the larger exponent
+     */
+    if ((b->e > a->e) || ((b->e == a->e) && (b->m > a->m))) {
+	t = a;
+	a = b;
+	b = t;
+    }
+    d = a->e - b->e;
+    ma = a->m << 7;
+    mb = b->m << 7;
+    lost = 0;
+    if (d > 31) {
+	lost = mb;
+	mb = 0;
+    } else if (d > 0) {
+	lost = mb & (((uint32)1 << d) - 1);
+	mb >>= d;
+    }
+
+    c->s = a->s;
+    c->e = a->e;
+    if (a->s == b->s) {
+	ma += mb;
+	if (ma & 0x80000000L) {
+	    ma >>= 1;
+	    ++c->e;
+	}
+    } else {
+	ma -= mb;
+	if (lost)
+	    --ma;
+	if (ma == 0) {
+	    c->m = 0;
+	    c->s = 0;
+	    return;
+	}
+	while ((ma & 0x40000000L) == 0) {
+	    ma <<= 1;
+	    --c->e;
+	}
+    }
+    c->m = ma >> 7;
+}
+
+
+/* FADD: c = a + b
+ */
+int afadd(unsigned char *pa, unsigned char *pb, unsigned char *pc) {
+    struct af a, b, c;
+
+    unpack(pa, &a);
+    unpack(pb, &b);
+    addf(&a, &b, &c);
+    return pack(&c, pc);
+}
+
+
+/* FSUB: c = a - b
+ */
+int afsub(unsigned char *pa, unsigned char *pb, unsigned char *pc) {
+    struct af a, b, c;
+
+    unpack(pa, &a);
+    unpack(pb, &b);
+    b.s ^= 0x80;
+    addf(&a, &b, &c);
+    return pack(&c, pc);
+}
+
+
+/* FMUL: c = a * b
+ *
+ * 24x24->48 bit mantissa product, from four 12x12->24 bit products,
+ * so that 32 bit arithmetic is enough. Only the top 24 bits (25 if
+ * the product needs normalizing) are kept.
+ */
+int afmul(unsigned char *pa, unsigned char *pb, unsigned char *pc) {
+    struct af a, b, c;
+    uint32 a1, a0, b1, b0, lo, mid, hi;
+
+    unpack(pa, &a);
+    unpack(pb, &b);
+    c.s = a.s ^ b.s;
+    if ((a.m == 0) || (b.m == 0)) {
+	c.m = 0;
+	return pack(&c, pc);
+    }
+
+    a1 = a.m >> 12;
+    a0 = a.m & 0xfff;
+    b1 = b.m >> 12;
+    b0 = b.m & 0xfff;
+    lo = a0 * b0;
+    mid = a1 * b0 + a0 * b1 + (lo >> 12);
+    hi = a1 * b1 + (mid >> 12);
+    lo = ((mid & 0xfff) << 12) | (lo & 0xfff);
+
+    /* Product is hi:lo, 24:24 bits, 0.25 <= hi:lo < 1.0
+     */
+    c.e = a.e + b.e;
+    if ((hi & 0x800000L) == 0) {
+	hi = (hi << 1) | (lo >> 23);
+	--c.e;
+    }
+    c.m = hi;
+    return pack(&c, pc);
+}
+
+
+/* FDIV: c = a / b
+ *
+ * Restoring division, one quotient bit at a time on the z80, a single
+ * 64 bit divide elsewhere. Divide by zero returns AM_ERR_DIV0, and
+ * leaves a as the result.
+ */
+int afdiv(unsigned char *pa, unsigned char *pb, unsigned char *pc) {
+    struct af a, b, c;
+    uint32 q, r;
+#ifdef z80
+    int i;
+#endif
+
+    unpack(pa, &a);
+    unpack(pb, &b);
+    if (b.m == 0) {
+	pack(&a, pc);
+	return AM_ERR_DIV0;
+    }
+    c.s = a.s ^ b.s;
+    if (a.m == 0) {
+	c.m = 0;
+	return pack(&c, pc);
+    }
+
+    /* a.m / b.m is 0.5 .. 2.0. Scale so that the first quotient bit is
+     * always 1.
+     */
+    c.e = a.e - b.e + 1;
+    r = a.m;
+    if (r < b.m) {
+	r <<= 1;
+	--c.e;
+    }
+#ifdef z80
+    q = 0;
+    for (i = 0; i < 24; ++i) {
+	q <<= 1;
+	if (r >= b.m) {
+	    r -= b.m;
+	    q |= 1;
+	}
+	r <<= 1;
+    }
+#else
+    q = ((uint64_t)r << 23) / b.m;
+#endif
+    c.m = q;
+    return pack(&c, pc);
+}
+
+
+/* Fixed point helpers for the functions below.
+ *
+ * A "fixed" value is a 32 bit v with a scale e, value = v x 2^(e-32).
+ * It is normalized if bit 31 of v is set. Q30 is fixed with e = 2.
+ */
+
+/* High 32 bits of 32x32 bit product
+ */
+#ifdef z80
+static uint32 umulh(uint32 a, uint32 b) {
+    uint32 a1, a0, b1, b0, m1, m2, mid;
+
+    a1 = a >> 16;
+    a0 = a & 0xffff;
+    b1 = b >> 16;
+    b0 = b & 0xffff;
+    m1 = a1 * b0;
+    m2 = a0 * b1;
+    mid = ((a0 * b0) >> 16) + (m1 & 0xffff) + (m2 & 0xffff);
+    return a1 * b1 + (m1 >> 16) + (m2 >> 16) + (mid >> 16);
+}
+#else
+#define umulh(a, b) ((uint32)(((uint64_t)(a) * (b)) >> 32))
+#endif
+
+
+/* n x 2^32 / d, n < d
+ */
+#ifdef z80
+static uint32 udiv(uint32 n, uint32 d) {
+    uint32 q, c;
+    int i;
+
+    q = 0;
+    for (i = 0; i < 32; ++i) {
+	c = n & 0x80000000L;
+	n <<= 1;
+	q <<= 1;
+	if (c || (n >= d)) {
+	    n -= d;
+	    q |= 1;
+	}
+    }
+    return q;
+}
+#else
+#define udiv(n, d) ((uint32)(((uint64_t)(n) << 32) / (d)))
+#endif
+
+
+/* sqrt(z x 4^n), digit by digit. The root must be less than 2^29.
+ */
+static uint32 isqrt(uint32 z, int n) {
+    uint32 r, rem, t;
+    int i;
+
+    r = rem = 0;
+    for (i = 0; i < 16 + n; ++i) {
+	rem = (rem << 2) | (z >> 30);
+	z <<= 2;
+	r <<= 1;
+	t = (r << 1) | 1;
+	if (rem >= t) {
+	    rem -= t;
+	    r |= 1;
+	}
+    }
+    return r;
+}
+
+
+/* Shift v left until bit 31 is set. Returns the shift count. v must
+ * not be 0.
+ */
+static int norm(uint32 *v) {
+    int n = 0;
+
+    while ((*v & 0xff000000L) == 0) {
+	*v <<= 8;
+	n += 8;
+    }
+    while ((*v & 0x80000000L) == 0) {
+	*v <<= 1;
+	++n;
+    }
+    return n;
+}
+
+
+/* Set c to fixed v, e (truncated to 24 bits). Sign is left alone.
+ */
+static void fx(struct af *c, uint32 v, int e) {
+    if (v == 0) {
+	c->m = 0;
+	return;
+    }
+    e -= norm(&v);
+    c->m = v >> 8;
+    c->e = e;
+}
+
+
+/* Fixed (normalized) to Q30. Value must be less than 4.
+ */
+static uint32 q30(uint32 v, int e) {
+    if (e < -29)
+	return 0;
+    return v >> (2 - e);
+}
+
+
+/* Normalized fixed n / d. Quotient is left in *q, and the scale is
+ * returned.
+ */
+static int fxdiv(uint32 n, int en, uint32 d, int ed, uint32 *q) {
+    if (n < d) {
+	*q = udiv(n, d);
+	return en - ed;
+    }
+    *q = 0x80000000L | (udiv(n - d, d) >> 1);
+    return en - ed + 1;
+}
+
+
+/* Polynomial in t (Q30, 0 <= t <= 1), by Horner's rule. Coefficients
+ * are Q30, highest power first. The result must be positive.
+ */
+static uint32 poly(int32 *c, int n, uint32 t) {
+    int32 p;
+
+    t <<= 1;
+    p = *c++;
+    while (--n) {
+	if (p < 0)
+	    p = -(int32)umulh((uint32)-p << 1, t);
+	else
+	    p = umulh((uint32)p << 1, t);
+	p += *c++;
+    }
+    return p;
+}
+
+
+/* x^2 as Q30, x normalized fixed v, e, and x <= 1
+ */
+static uint32 sq30(uint32 v, int e) {
+    int sh = 2 - 2 * e;
+
+    if (sh > 31)
+	return 0;
+    return umulh(v, v) >> sh;
+}
+
+
+/* x f(t), for f given as a polynomial (t is x^2, or near enough). x
+ * is normalized fixed v, e. Result is fixed, scale e + 1 (and is not
+ * normalized).
+ */
+static uint32 oddf(int32 *c, int n, uint32 v, uint32 t) {
+    return umulh(v, poly(c, n, t) << 1);
+}
+
+
+/* Polynomials for the circular functions. These are Chebyshev fits
+ * over the reduced argument range, turned back into power series, so
+ * that the error is spread evenly over the range (less than 2^-30).
+ * Q30, highest power first.
+ */
+
+/* sin(x)/x, in x^2, 0 <= x <= 1
+ */
+static int32 sintab[] = {
+    2892L, -212986L, 8947828L, -178956968L, 1073741824L
+};
+
+/* cos(x), in x^2, 0 <= x <= 1
+ */
+static int32 costab[] = {
+    -289L, 26623L, -1491304L, 44739242L, -536870912L, 1073741824L
+};
+
+/* atan(x)/x, in x^2, 0 <= x <= tan(pi/12)
+ */
+static int32 atntab[] = {
+    103379078L, -152421925L, 214723844L, -357913723L, 1073741824L
+};
+
+/* asin(x)/x, in x^2, 0 <= x <= 1/2
+ */
+static int32 asntab[] = {
+    40455519L, 15349415L, 34206396L, 47790863L, 80536772L,
+    178956874L, 1073741824L
+};
+
+#define NSIN (sizeof(sintab) / sizeof(sintab[0]))
+#define NCOS (sizeof(costab) / sizeof(costab[0]))
+#define NATN (sizeof(atntab) / sizeof(atntab[0]))
+#define NASN (sizeof(asntab) / sizeof(asntab[0]))
+
+/* Constants, Q30 (PI2Q31 is pi/2 in Q31)
+ */
+#define PI2    0x6487ed51L
+#define PI     0xc90fdaa2L
+#define PI6    0x2182a470L
+#define SQRT3  0x6ed9eba1L
+#define TAN15  0x1126145fL
+#define PI2Q31 0xc90fdaa2L
+
+/* 2/pi, first 160 bits after the binary point
+ */
+static uint32 twopi[] = {
+    0xa2f9836eL, 0x4e441529L, 0xfc2757d1L, 0xf534ddc0L, 0xdb629599L
+};
+
+
+/* 32 bits of floor(2/pi x 2^160) >> n
+ */
+static uint32 tpbits(int n) {
+    int w, b;
+    uint32 r;
+
+    w = 4 - (n >> 5);
+    b = n & 31;
+    if (w < 0)
+	return 0;
+    r = twopi[w] >> b;
+    if (b && w)
+	r |= twopi[w - 1] << (32 - b);
+    return r;
+}
+
+
+/* Reduce |a| for the circular functions. a = q x pi/2 + theta, with
+ * |theta| <= pi/4 (or theta = |a| if |a| < 1, and q = 0). theta is
+ * returned as normalized fixed *v, *e, with the sign in *s. Returns q
+ * (mod 4).
+ *
+ * Only the bits of 2/pi that matter are used: the window starts where
+ * a x 2/pi has weight 2, and is 96 bits long. That leaves 70 bits of
+ * fraction, which is enough for the closest that any AM9511 float
+ * gets to a multiple of pi/2.
+ */
+static int reduce(struct af *a, uint32 *v, int *e, unsigned char *s) {
+    uint32 w2, w1, w0, p2, p1, p0, t;
+    int q, n;
+
+    *s = 0;
+    if (a->e <= 0) {
+	*v = a->m << 8;
+	*e = a->e;
+	return 0;
+    }
+
+    /* Window is bits a->e - 25 .. a->e + 70 of 2/pi (bit i has weight
+     * 2^-i, and bits before bit 1 are 0)
+     */
+    n = 90 - a->e;
+    w2 = tpbits(n + 64);
+    w1 = tpbits(n + 32);
+    w0 = tpbits(n);
+
+    /* a->m x window, low 96 bits. Bits 94,95 are q, 0..93 the fraction
+     */
+    p0 = a->m * w0;
+    t = a->m * w1;
+    p1 = t + umulh(a->m, w0);
+    p2 = umulh(a->m, w1) + a->m * w2 + (p1 < t);
+    q = (p2 >> 30) & 3;
+    p2 &= 0x3fffffffL;
+
+    /* Round to nearest quadrant
+     */
+    if (p2 & 0x20000000L) {
+	q = (q + 1) & 3;
+	*s = 0x80;
+	p0 = -p0;
+	p1 = -p1 - (p0 != 0);
+	p2 = 0x40000000L - p2 - ((p0 | p1) != 0);
+    }
+
+    /* Normalize fraction p2:p1:p0 (x 2^-94)
+     */
+    *e = 2;
+    while (p2 == 0) {
+	if ((p1 | p0) == 0) {
+	    *v = 0;
+	    return q;
+	}
+	p2 = p1;
+	p1 = p0;
+	p0 = 0;
+	*e -= 32;
+    }
+    n = norm(&p2);
+    if (n)
+	p2 |= p1 >> (32 - n);
+    *e -= n;
+
+    /* theta = fraction x pi/2
+     */
+    *v = umulh(p2, PI2Q31);
+    *e += 1;
+    if ((*v & 0x80000000L) == 0) {
+	*v <<= 1;
+	--*e;
+    }
+    return q;
+}
+
+
+/* sin(q x pi/2 + theta), theta as from reduce() (sign s)
+ */
+static void sinq(int q, uint32 v, int e, unsigned char s, struct af *c) {
+    if (q & 1) {
+	fx(c, poly(costab, NCOS, sq30(v, e)), 2);
+	c->s = 0;
+    } else {
+	fx(c, oddf(sintab, NSIN, v, sq30(v, e)), e + 1);
+	c->s = s;
+    }
+    if (q & 2)
+	c->s ^= 0x80;
+}
+
+
+/* SIN: c = sin(a)
+ */
+int afsin(unsigned char *pa, unsigned char *pc) {
+    struct af a, c;
+    uint32 v;
+    int e, q;
+    unsigned char s;
+
+    unpack(pa, &a);
+    q = reduce(&a, &v, &e, &s);
+    sinq(q, v, e, s, &c);
+    c.s ^= a.s;
+    return pack(&c, pc);
+}
+
+
+/* COS: c = cos(a) = sin(|a| + pi/2)
+ */
+int afcos(unsigned char *pa, unsigned char *pc) {
+    struct af a, c;
+    uint32 v;
+    int e, q;
+    unsigned char s;
+
+    unpack(pa, &a);
+    q = reduce(&a, &v, &e, &s);
+    sinq(q + 1, v, e, s, &c);
+    return pack(&c, pc);
+}
+
+
+/* TAN: c = tan(a)
+ *
+ * As the guide says, tan(a) is a for |a| < 2^-12.
+ */
+int aftan(unsigned char *pa, unsigned char *pc) {
+    struct af a, c;
+    uint32 sv, cv, t;
+    int e, se, ce, q;
+    unsigned char s;
+
+    unpack(pa, &a);
+    if (a.e <= -12)
+	return pack(&a, pc);
+    q = reduce(&a, &sv, &e, &s);
+    cv = poly(costab, NCOS, sq30(sv, e));
+    sv = oddf(sintab, NSIN, sv, sq30(sv, e));
+    c.s = s ^ a.s;
+    se = e + 1;
+    ce = 2;
+    if (q & 1) {
+	/* tan(theta + pi/2) = -cos(theta) / sin(theta)
+	 */
+	c.s ^= 0x80;
+	t = sv;
+	sv = cv;
+	cv = t;
+	se = 2;
+	ce = e + 1;
+    }
+    if (cv == 0) {
+	c.m = 0xffffffL;
+	c.e = 64;
+	return pack(&c, pc);
+    }
+    if (sv == 0) {
+	c.m = 0;
+	return pack(&c, pc);
+    }
+    se -= norm(&sv);
+    ce -= norm(&cv);
+    e = fxdiv(sv, se, cv, ce, &sv);
+    fx(&c, sv, e);
+    return pack(&c, pc);
+}
+
+
+/* ATAN: c = atan(a)
+ *
+ * For |a| > 1, atan(|a|) = pi/2 - atan(1/|a|). Then, above tan(pi/12),
+ * atan(x) = pi/6 + atan((x sqrt(3) - 1) / (x + sqrt(3))). What is left
+ * is in the range of the polynomial.
+ */
+int afatan(unsigned char *pa, unsigned char *pc) {
+    struct af a, c;
+    uint32 v, r, n, d;
+    int e, en, ed, inv, neg;
+
+    unpack(pa, &a);
+    c.s = a.s;
+    if (a.m == 0)
+	return pack(&a, pc);
+    v = a.m << 8;
+    e = a.e;
+    inv = (e > 1) || ((e == 1) && (v != 0x80000000L));
+    if (inv)
+	e = fxdiv(0x80000000L, 1, v, e, &v);
+
+    r = q30(v, e);
+    if (r > TAN15) {
+	n = umulh(r << 1, SQRT3 << 1);
+	d = r + SQRT3;
+	neg = n < 0x40000000L;
+	n = neg ? 0x40000000L - n : n - 0x40000000L;
+	r = PI6;
+	if (n) {
+	    en = 2 - norm(&n);
+	    ed = 2 - norm(&d);
+	    e = fxdiv(n, en, d, ed, &v);
+	    n = q30(oddf(atntab, NATN, v, sq30(v, e)), e + 1);
+	    r = neg ? r - n : r + n;
+	}
+    } else if (inv) {
+	r = q30(oddf(atntab, NATN, v, sq30(v, e)), e + 1);
+    } else {
+	fx(&c, oddf(atntab, NATN, v, sq30(v, e)), e + 1);
+	return pack(&c, pc);
+    }
+    if (inv)
+	r = PI2 - r;
+    fx(&c, r, 2);
+    return pack(&c, pc);
+}
+
+
+/* asin(|a|), |a| <= 1.
+ *
+ * For |a| < 1/2, *v, *e is |a| f(a^2), and 0 is returned. Otherwise,
+ * asin(|a|) = pi/2 - 2 asin(sqrt(z)), z = (1 - |a|) / 2. 2 asin(sqrt(z))
+ * is left in *v, *e, and 1 is returned.
+ */
+static int asn(struct af *a, uint32 *v, int *e) {
+    uint32 z, t;
+    int k;
+
+    if ((a->e < 0) || (a->m == 0)) {
+	*v = a->m << 8;
+	*v = oddf(asntab, NASN, *v, sq30(*v, a->e));
+	*e = a->e + 1;
+	return 0;
+    }
+
+    /* 1 - |a| is exact in Q30
+     */
+    z = (0x40000000L - (a->m << (6 + a->e))) >> 1;
+    t = z;
+    if (z == 0) {
+	*v = 0;
+	*e = 0;
+	return 1;
+    }
+    k = 0;
+    while ((z & 0x30000000L) == 0) {
+	z <<= 2;
+	++k;
+    }
+
+    /* sqrt(z) is normalized fixed, scale -k
+     */
+    z = isqrt(z, 14) << 3;
+    *v = oddf(asntab, NASN, z, t);
+    *e = 2 - k;
+    return 1;
+}
+
+
+/* ASIN: c = asin(a). |a| > 1 returns AM_ERR_ARG, and c is not changed.
+ */
+int afasin(unsigned char *pa, unsigned char *pc) {
+    struct af a, c;
+    uint32 v;
+    int e;
+
+    unpack(pa, &a);
+    if ((a.e > 1) || ((a.e == 1) && (a.m != 0x800000L)))
+	return AM_ERR_ARG;
+    c.s = a.s;
+    if (asn(&a, &v, &e))
+	fx(&c, PI2 - q30(v, e), 2);
+    else
+	fx(&c, v, e);
+    return pack(&c, pc);
+}
+
+
+/* ACOS: c = acos(a). |a| > 1 returns AM_ERR_ARG, and c is not changed.
+ */
+int afacos(unsigned char *pa, unsigned char *pc) {
+    struct af a, c;
+    uint32 v;
+    int e;
+
+    unpack(pa, &a);
+    if ((a.e > 1) || ((a.e == 1) && (a.m != 0x800000L)))
+	return AM_ERR_ARG;
+    c.s = 0;
+    if (asn(&a, &v, &e)) {
+	if (a.s)
+	    fx(&c, PI - q30(v, e), 2);
+	else
+	    fx(&c, v, e);
+    } else {
+	v = q30(v, e);
+	fx(&c, a.s ? PI2 + v : PI2 - v, 2);
+    }
+    return pack(&c, pc);
+}
+
+
+/* Polynomials for the logarithm and exponential (as for the circular
+ * functions above)
+ */
+
+/* atanh(x)/x, in x^2, 0 <= x <= (sqrt(2) - 1) / (sqrt(2) + 1)
+ */
+static int32 lntab[] = {
+    126789353L, 153196389L, 214750430L, 357913934L, 1073741824L
+};
+
+/* exp(x), in x, 0 <= x <= ln(2)
+ */
+static int32 exptab[] = {
+    302296L, 1384716L, 9012151L, 44718013L, 178960753L, 536870582L,
+    1073741835L, 1073741824L
+};
+
+#define NLN  (sizeof(lntab) / sizeof(lntab[0]))
+#define NEXP (sizeof(exptab) / sizeof(exptab[0]))
+
+/* ln(2) in Q32, log10(e) normalized (x 2^-1), 1/ln(2) in Q16 and
+ * sqrt(1/2) as a mantissa
+ */
+#define LN2    0xb17217f8L
+#define LOG10E 0xde5bd8a9L
+#define RLN2   94548L
+#define SQRTH  0xb504f3L
+
+
+/* ln(a), a > 0. Result is normalized fixed *v, *e (*v is 0 for
+ * ln(1)). Returns the sign.
+ *
+ * a = f x 2^k, with sqrt(1/2) <= f < sqrt(2). Then ln(a) = k ln(2) +
+ * 2 atanh(s), s = (f - 1) / (f + 1). k ln(2) is added in 64 bits (as
+ * two words), so that the sum keeps its precision when the two nearly
+ * cancel.
+ */
+static unsigned char lnf(struct af *a, uint32 *v, int *e) {
+    uint32 n, d, hi, lo, y;
+    int k, ne, de;
+    unsigned char s, neg;
+
+    k = a->e;
+    n = a->m;
+    if (n < SQRTH) {
+	n <<= 1;
+	--k;
+    }
+
+    /* s = (f - 1) / (f + 1), f is n x 2^-24
+     */
+    d = n + 0x1000000L;
+    s = 0;
+    if (n < 0x1000000L) {
+	n = 0x1000000L - n;
+	s = 0x80;
+    } else
+	n -= 0x1000000L;
+    if (n == 0) {
+	if (k == 0) {
+	    *v = 0;
+	    *e = 0;
+	    return 0;
+	}
+	y = 0;
+    } else {
+	ne = 8 - norm(&n);
+	de = 8 - norm(&d);
+	*e = fxdiv(n, ne, d, de, v);
+	y = oddf(lntab, NLN, *v, sq30(*v, *e));
+	*e += 2;
+	if (k == 0) {
+	    *e -= norm(&y);
+	    *v = y;
+	    return s;
+	}
+	y = (*e > -32) ? y >> -*e : 0;
+    }
+
+    /* k ln(2) +- y, Q32. The result has the sign of k, and |y| is less
+     * than ln(2)/2.
+     */
+    neg = 0;
+    if (k < 0) {
+	k = -k;
+	neg = 0x80;
+    }
+    lo = k * LN2;
+    hi = umulh((uint32)k, LN2);
+    if (s != neg) {
+	hi -= (lo < y);
+	lo -= y;
+    } else {
+	lo += y;
+	hi += (lo < y);
+    }
+    if (hi) {
+	ne = norm(&hi);
+	*v = ne ? hi | (lo >> (32 - ne)) : hi;
+	*e = 32 - ne;
+    } else {
+	*e = -norm(&lo);
+	*v = lo;
+    }
+    return neg;
+}
+
+
+/* Normalized fixed v, e to Q32 (as two words). The value must be less
+ * than 2^32.
+ */
+static void q32(uint32 v, int e, uint32 *hi, uint32 *lo) {
+    if (e >= 32) {
+	*hi = v;
+	*lo = 0;
+    } else if (e > 0) {
+	*hi = v >> (32 - e);
+	*lo = v << e;
+    } else {
+	*hi = 0;
+	*lo = (e > -32) ? v >> -e : 0;
+    }
+}
+
+
+/* exp(u), u is Q32 hi:lo (u <= 32), negated if s is set
+ *
+ * u = k ln(2) + r, 0 <= r < ln(2), and exp(u) = 2^k exp(r). For -u,
+ * use k + 1 and ln(2) - r.
+ */
+static void expk(uint32 hi, uint32 lo, unsigned char s, struct af *c) {
+    uint32 th, tl;
+    int k;
+
+    /* Estimate k from u in Q8, and then correct it
+     */
+    k = (((hi << 8) | (lo >> 24)) * RLN2) >> 24;
+    tl = k * LN2;
+    th = umulh((uint32)k, LN2);
+    hi -= th + (lo < tl);
+    lo -= tl;
+    while (hi & 0x80000000L) {
+	--k;
+	lo += LN2;
+	hi += (lo < LN2);
+    }
+    while (hi || (lo >= LN2)) {
+	++k;
+	hi -= (lo < LN2);
+	lo -= LN2;
+    }
+    if (s) {
+	lo = LN2 - lo;
+	k = -k - 1;
+    }
+    fx(c, poly(exptab, NEXP, lo >> 2), k + 2);
+    c->s = 0;
+}
+
+
+/* SQRT: c = sqrt(a). Negative a returns AM_ERR_NEG, and c is not
+ * changed.
+ *
+ * The 24 bit root of the mantissa (with an even exponent) is done
+ * digit by digit, so that the result is exactly truncated.
+ */
+int afsqrt(unsigned char *pa, unsigned char *pc) {
+    struct af a, c;
+
+    unpack(pa, &a);
+    if (a.m == 0)
+	return pack(&a, pc);
+    if (a.s)
+	return AM_ERR_NEG;
+    c.s = 0;
+    if (a.e & 1) {
+	c.m = isqrt(a.m << 7, 8);
+	c.e = (a.e + 1) / 2;
+    } else {
+	c.m = isqrt(a.m << 8, 8);
+	c.e = a.e / 2;
+    }
+    return pack(&c, pc);
+}
+
+
+/* LN LOG: c = ln(a), log10(a). a <= 0 returns AM_ERR_NEG, and c is not
+ * changed.
+ */
+int afln(unsigned char *pa, unsigned char *pc) {
+    struct af a, c;
+    uint32 v;
+    int e;
+
+    unpack(pa, &a);
+    if (a.s || (a.m == 0))
+	return AM_ERR_NEG;
+    c.s = lnf(&a, &v, &e);
+    fx(&c, v, e);
+    return pack(&c, pc);
+}
+
+int aflog(unsigned char *pa, unsigned char *pc) {
+    struct af a, c;
+    uint32 v;
+    int e;
+
+    unpack(pa, &a);
+    if (a.s || (a.m == 0))
+	return AM_ERR_NEG;
+    c.s = lnf(&a, &v, &e);
+    fx(&c, umulh(v, LOG10E), e - 1);
+    return pack(&c, pc);
+}
+
+
+/* EXP: c = exp(a). |a| > 32 returns AM_ERR_ARG, and c is not changed.
+ */
+int afexp(unsigned char *pa, unsigned char *pc) {
+    struct af a, c;
+    uint32 hi, lo;
+
+    unpack(pa, &a);
+    if ((a.e > 6) || ((a.e == 6) && (a.m != 0x800000L)))
+	return AM_ERR_ARG;
+    q32(a.m << 8, a.e, &hi, &lo);
+    expk(hi, lo, a.s, &c);
+    return pack(&c, pc);
+}
+
+
+/* PWR: c = a^b = exp(b ln(a))
+ *
+ * Done as one kernel: ln(a) is kept to 32 bits, and the product goes
+ * straight to the exponential. Negative a returns AM_ERR_NEG, and
+ * b ln(a) outside -32..32 (or a = 0) returns AM_ERR_ARG. c is not
+ * changed on error.
+ */
+int afpwr(unsigned char *pa, unsigned char *pb, unsigned char *pc) {
+    struct af a, b, c;
+    uint32 v, hi, lo;
+    int e;
+    unsigned char s;
+
+    unpack(pa, &a);
+    unpack(pb, &b);
+    if (a.m == 0)
+	return a.s ? AM_ERR_NEG : AM_ERR_ARG;
+    if (a.s)
+	return AM_ERR_NEG;
+    s = lnf(&a, &v, &e) ^ b.s;
+    v = umulh(v, b.m << 8);
+    if (v == 0) {
+	hi = lo = 0;
+    } else {
+	e += b.e;
+	e -= norm(&v);
+	if ((e > 6) || ((e == 6) && (v != 0x80000000L)))
+	    return AM_ERR_ARG;
+	q32(v, e, &hi, &lo);
+    }
+    expk(hi, lo, s, &c);
+    return pack(&c, pc);
+}
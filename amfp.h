@@ -0,0 +1,28 @@
+/* amfp.h
+ *
+ * AM9511 format floating point, done with integer arithmetic only.
+ * No host float, and no math library.
+ */
+
+#ifndef _AMFP_H
+#define _AMFP_H
+
+int afadd(unsigned char *pa, unsigned char *pb, unsigned char *pc);
+int afsub(unsigned char *pa, unsigned char *pb, unsigned char *pc);
+int afmul(unsigned char *pa, unsigned char *pb, unsigned char *pc);
+int afdiv(unsigned char *pa, unsigned char *pb, unsigned char *pc);
+
+int afsin(unsigned char *pa, unsigned char *pc);
+int afcos(unsigned char *pa, unsigned char *pc);
+int aftan(unsigned char *pa, unsigned char *pc);
+int afatan(unsigned char *pa, unsigned char *pc);
+int afasin(unsigned char *pa, unsigned char *pc);
+int afacos(unsigned char *pa, unsigned char *pc);
+
+int afsqrt(unsigned char *pa, unsigned char *pc);
+int afln(unsigned char *pa, unsigned char *pc);
+int aflog(unsigned char *pa, unsigned char *pc);
+int afexp(unsigned char *pa, unsigned char *pc);
+int afpwr(unsigned char *pa, unsigned char *pb, unsigned char *pc);
+
+#endif
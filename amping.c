@@ -0,0 +1,163 @@
+/* amping.c
+ *
+ * Round trip latency of the AM9511 interface (host only). Link with
+ * amclient.c to measure the daemon (amd), or with am9511.c to compare
+ * with the emulator in the same process.
+ *
+ *   amping [-n rounds] [name ...]
+ *
+ *   trip   push a byte, pop it back
+ *   stat   NOP, then poll status until not busy
+ *   fmul   push two floats, FMUL, poll status, pop the result
+ *
+ * Each round is timed by itself. The mean, median, 99th percentile
+ * and worst are given in ns (each includes a clock read, some 20 ns).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "am9511.h"
+
+
+static unsigned sum;
+
+
+static void ptrip(void *am9511) {
+    am_push(am9511, sum);
+    sum += am_pop(am9511);
+}
+
+static void pstat(void *am9511) {
+    am_command(am9511, AM_NOP);
+    while (am_status(am9511) & AM_BUSY)
+	;
+}
+
+static void pfmul(void *am9511) {
+    static unsigned char a[4] = { 0xdb, 0x0f, 0xc9, 0x02 };  /* pi */
+    static unsigned char b[4] = { 0x00, 0x00, 0xa0, 0x03 };  /* 5 */
+    int i;
+
+    for (i = 0; i < 4; ++i)
+	am_push(am9511, a[i]);
+    for (i = 0; i < 4; ++i)
+	am_push(am9511, b[i]);
+    am_command(am9511, AM_FMUL);
+    while (am_status(am9511) & AM_BUSY)
+	;
+    for (i = 0; i < 4; ++i)
+	sum += am_pop(am9511);
+}
+
+
+struct ping {
+    char *name;
+    void (*fn)(void *);
+    char *desc;
+};
+
+static struct ping pings[] = {
+    { "trip", ptrip, "push a byte, pop it back" },
+    { "stat", pstat, "NOP, poll status" },
+    { "fmul", pfmul, "push two floats, FMUL, poll, pop" },
+    { NULL,   NULL,  NULL }
+};
+
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int cmp(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+
+/* Time rounds rounds of p, one at a time
+ */
+static void run(struct ping *p, void *am9511, long rounds, double *t) {
+    double t0, tot;
+    long i;
+
+    for (i = 0; i < rounds / 10 + 1; ++i)    /* warm up */
+	(*p->fn)(am9511);
+    tot = 0.0;
+    for (i = 0; i < rounds; ++i) {
+	t0 = now();
+	(*p->fn)(am9511);
+	t[i] = now() - t0;
+	tot += t[i];
+    }
+    qsort(t, rounds, sizeof (double), cmp);
+    printf("%-6s %9.0f mean %9.0f p50 %9.0f p99 %9.0f max ns  (%s)\n",
+	   p->name, tot / rounds, t[rounds / 2], t[rounds * 99 / 100],
+	   t[rounds - 1], p->desc);
+}
+
+
+static void usage(char *prog) {
+    struct ping *p;
+
+    printf("usage: %s [-n rounds] [name ...]\n", prog);
+    printf("    -n rounds  rounds per test (default 100000)\n");
+    printf("\n");
+    for (p = pings; p->name != NULL; ++p)
+	printf("    %-6s %s\n", p->name, p->desc);
+    exit(1);
+}
+
+
+int main(int ac, char **av) {
+    int ch, i;
+    long rounds;
+    double *t;
+    void *am9511;
+    struct ping *p;
+
+    rounds = 100000;
+    while ((ch = getopt(ac, av, "n:")) != EOF)
+	switch (ch) {
+	case 'n':
+	    rounds = atol(optarg);
+	    break;
+	case '?':
+	default:
+	    usage(av[0]);
+	}
+    ac -= optind;
+    av += optind;
+    if (rounds < 1)
+	rounds = 1;
+
+    t = malloc(rounds * sizeof (double));
+    am9511 = am_create(-1, -1);
+    if ((t == NULL) || (am9511 == NULL)) {
+	fprintf(stderr, "Cannot create\n");
+	return 1;
+    }
+
+    for (p = pings; p->name != NULL; ++p) {
+	if (ac > 0) {
+	    for (i = 0; i < ac; ++i)
+		if (strcmp(av[i], p->name) == 0)
+		    break;
+	    if (i == ac)
+		continue;
+	}
+	am_reset(am9511);
+	run(p, am9511, rounds, t);
+    }
+    am_destroy(am9511);
+    if (sum == 0)
+	printf("\n");
+    return 0;
+}
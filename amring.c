@@ -0,0 +1,258 @@
+/* amring.c
+ *
+ * An AM9511 chip on its own thread, fed through lock-free single
+ * producer, single consumer rings (host only, POSIX threads).
+ *
+ * The emulator CPU thread calls ar_push() ar_command() ar_pop() and
+ * ar_status() from its port handlers (in() and out(), see howto.txt)
+ * in place of am_push() etc. Pushes and commands go on the command
+ * ring, and the CPU thread goes on at once. ar_pop() puts a pop
+ * request on the command ring, and waits for the byte on the result
+ * ring. ar_status() does not wait: it reads AM_BUSY while the chip
+ * thread has messages still to do, else the status the chip thread
+ * left when it caught up (the real chip is also busy while it works).
+ *
+ * Each ring keeps its producer index and its consumer index on
+ * separate cache lines, each with the owner's copy of the other
+ * index. The other thread's line is only read when the ring looks
+ * full (producer) or empty (consumer), so while it is neither, a put
+ * or get is a few plain instructions and one release store. A thread
+ * that has to wait spins for a while (not on a single CPU, where the
+ * other thread cannot run meanwhile), then yields, then naps (AR_NAP
+ * ns at a time), so an idle chip thread costs little CPU time, but
+ * the first message after a long idle may wait for a nap to end.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "am9511.h"
+#include "amring.h"
+
+
+#define AR_LINE  64        /* cache line bytes */
+#define AR_SIZE  256       /* entries per ring, a power of 2 */
+#define AR_SPIN  64        /* waits spun before yielding (SMP) */
+#define AR_YIELD 256       /* waits yielded before napping */
+#define AR_NAP   50000     /* nap, ns */
+
+/* Messages on the command ring: kind | byte
+ */
+#define AR_PUSH  0x100
+#define AR_CMD   0x200
+#define AR_POP   0x300
+#define AR_RESET 0x400
+#define AR_STOP  0x500
+#define AR_KIND  0xf00
+
+#define ld_acq(p)    __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define ld_rlx(p)    __atomic_load_n(p, __ATOMIC_RELAXED)
+#define st_rel(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define st_rlx(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+
+
+/* One ring. Indices count up without wrapping (unsigned long), and
+ * are masked for buf[].
+ */
+struct ar_ring {
+    /* consumer line */
+    unsigned long head;     /* next entry to take */
+    unsigned long tcache;   /* consumer copy of tail */
+    unsigned char stat;     /* status, when head caught up with tail */
+    char pad1[AR_LINE - 2 * sizeof (unsigned long) - 1];
+    /* producer line */
+    unsigned long tail;     /* next entry to fill */
+    unsigned long hcache;   /* producer copy of head */
+    char pad2[AR_LINE - 2 * sizeof (unsigned long)];
+    unsigned short buf[AR_SIZE];
+};
+
+struct ar_link {
+    struct ar_ring cmd;     /* CPU thread to chip thread */
+    struct ar_ring res;     /* chip thread to CPU thread: popped bytes */
+    void *am9511;
+    pthread_t thr;
+};
+
+
+static int ar_spin = AR_SPIN;
+
+
+/* Wait a little. *n counts the waits so far: spin, then yield, then
+ * nap.
+ */
+static void ar_idle(int *n) {
+    struct timespec ts;
+
+    if (*n < ar_spin) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+	++*n;
+    } else if (*n < ar_spin + AR_YIELD) {
+	sched_yield();
+	++*n;
+    } else {
+	ts.tv_sec = 0;
+	ts.tv_nsec = AR_NAP;
+	nanosleep(&ts, NULL);
+    }
+}
+
+
+/* Put m on ring r (producer). Waits only if the ring is full.
+ */
+static void ar_put(struct ar_ring *r, unsigned m) {
+    unsigned long t = r->tail;
+    int n = 0;
+
+    while (t - r->hcache == AR_SIZE) {
+	r->hcache = ld_acq(&r->head);
+	if (t - r->hcache == AR_SIZE)
+	    ar_idle(&n);
+    }
+    r->buf[t & (AR_SIZE - 1)] = m;
+    st_rel(&r->tail, t + 1);
+}
+
+
+/* Look at the next entry of ring r (consumer), waiting for one if the
+ * ring is empty. ar_next() then frees it.
+ */
+static unsigned ar_get(struct ar_ring *r) {
+    unsigned long h = r->head;
+    int n = 0;
+
+    while (h == r->tcache) {
+	r->tcache = ld_acq(&r->tail);
+	if (h == r->tcache)
+	    ar_idle(&n);
+    }
+    return r->buf[h & (AR_SIZE - 1)];
+}
+
+static void ar_next(struct ar_ring *r) {
+    st_rel(&r->head, r->head + 1);
+}
+
+
+/* Chip thread: do the messages on the command ring, in order. The
+ * status is left for ar_status() after the last message it can see
+ * (if more were put meanwhile, head will not catch up with tail until
+ * a later one).
+ */
+static void *ar_chip(void *arg) {
+    struct ar_link *l = (struct ar_link *)arg;
+    unsigned m;
+
+    for (;;) {
+	m = ar_get(&l->cmd);
+	switch (m & AR_KIND) {
+	case AR_PUSH:
+	    am_push(l->am9511, m);
+	    break;
+	case AR_CMD:
+	    am_command(l->am9511, m);
+	    break;
+	case AR_POP:
+	    ar_put(&l->res, am_pop(l->am9511));
+	    break;
+	case AR_RESET:
+	    am_reset(l->am9511);
+	    break;
+	case AR_STOP:
+	    ar_next(&l->cmd);
+	    return NULL;
+	}
+	if (l->cmd.head + 1 == l->cmd.tcache)
+	    st_rlx(&l->cmd.stat, am_status(l->am9511));
+	ar_next(&l->cmd);
+    }
+}
+
+
+/* Start a chip thread for am9511 (from am_create()). From now until
+ * ar_destroy(), the chip must only be used through ar_push() etc.
+ * Returns NULL if it cannot.
+ */
+void *ar_create(void *am9511) {
+    struct ar_link *l;
+    void *p;
+
+    if (sysconf(_SC_NPROCESSORS_ONLN) == 1)
+	ar_spin = 0;
+    if (posix_memalign(&p, AR_LINE, sizeof (struct ar_link)) != 0)
+	return NULL;
+    l = (struct ar_link *)p;
+    memset(l, 0, sizeof (struct ar_link));
+    l->am9511 = am9511;
+    l->cmd.stat = am_status(am9511);
+    if (pthread_create(&l->thr, NULL, ar_chip, l) != 0) {
+	free(l);
+	return NULL;
+    }
+    return l;
+}
+
+
+/* Stop the chip thread, after the messages already put. The chip is
+ * not destroyed.
+ */
+void ar_destroy(void *p) {
+    struct ar_link *l = (struct ar_link *)p;
+
+    ar_put(&l->cmd, AR_STOP);
+    pthread_join(l->thr, NULL);
+    free(l);
+}
+
+
+/* Port handlers
+ */
+void ar_push(void *p, unsigned char b) {
+    ar_put(&((struct ar_link *)p)->cmd, AR_PUSH | b);
+}
+
+void ar_command(void *p, unsigned char op) {
+    ar_put(&((struct ar_link *)p)->cmd, AR_CMD | op);
+}
+
+unsigned char ar_pop(void *p) {
+    struct ar_link *l = (struct ar_link *)p;
+    unsigned char b;
+
+    ar_put(&l->cmd, AR_POP);
+    b = ar_get(&l->res);
+    ar_next(&l->res);
+    return b;
+}
+
+unsigned char ar_status(void *p) {
+    struct ar_link *l = (struct ar_link *)p;
+
+    if (ld_acq(&l->cmd.head) != l->cmd.tail)
+	return AM_BUSY;
+    return ld_rlx(&l->cmd.stat);
+}
+
+void ar_reset(void *p) {
+    ar_put(&((struct ar_link *)p)->cmd, AR_RESET);
+}
+
+
+/* Wait until the chip thread has done every message put so far. The
+ * chip may then be looked at directly (until the next message).
+ */
+void ar_sync(void *p) {
+    struct ar_link *l = (struct ar_link *)p;
+    int n = 0;
+
+    while (ld_acq(&l->cmd.head) != l->cmd.tail)
+	ar_idle(&n);
+}
@@ -0,0 +1,18 @@
+/* amring.h
+ *
+ * AM9511 chip on its own thread, fed through rings (host only).
+ */
+
+#ifndef _AMRING_H
+#define _AMRING_H
+
+void         *ar_create(void *am9511);
+void          ar_destroy(void *);
+void          ar_push(void *, unsigned char);
+void          ar_command(void *, unsigned char);
+unsigned char ar_pop(void *);
+unsigned char ar_status(void *);
+void          ar_reset(void *);
+void          ar_sync(void *);
+
+#endif
@@ -0,0 +1,117 @@
+/* amshm.h
+ *
+ * Shared memory between amd (the AM9511 daemon) and amclient.c (its
+ * client side), host only, Linux (futex).
+ *
+ * The segment (POSIX shared memory, AS_NAME, or $AM9511_SHM) is a
+ * header, then nslot slots. A client process claims a free slot, and
+ * with it one of the daemon's chips. Each slot has two rings, in the
+ * manner of amring.c: commands (pushes, commands, pop requests) from
+ * the client, and popped bytes back. Bytes are put straight into the
+ * rings, and taken straight out, by each side: nothing is copied on
+ * the way, and nothing goes through the kernel unless one side sleeps.
+ *
+ * A side that waits for the other sleeps in a futex: the daemon on
+ * bell (the clients add 1 and wake it, if sleep is set), a client on
+ * the result ring's tail (the daemon wakes it, if wait is set). The
+ * flag is stored, and then the ring looked at again, sequentially
+ * consistent, against the reverse on the other side, so that one of
+ * the two always sees the other.
+ */
+
+#ifndef _AMSHM_H
+#define _AMSHM_H
+
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "types.h"
+
+#define AS_NAME    "/am9511"
+#define AS_MAGIC   0x414d3935UL  /* "AM95" */
+#define AS_VERSION 2
+#define AS_LINE    64            /* cache line bytes */
+#define AS_SIZE    256           /* entries per ring, a power of 2 */
+#define AS_SLOTS   64            /* default slots */
+
+/* Messages on the command ring: kind | byte
+ */
+#define AS_PUSH    0x100
+#define AS_CMD     0x200
+#define AS_POP     0x300
+#define AS_RESET   0x400
+#define AS_OPEN    0x500  /* slot claimed: reset the chip */
+#define AS_CLOSE   0x600  /* slot given up: free it */
+#define AS_KIND    0xf00
+
+/* Slot state: AS_FREE, or the pid of the client that has the slot.
+ * A client takes a slot and gives its pid in one compare and swap,
+ * so the daemon never sees a taken slot with its last owner's pid.
+ */
+#define AS_FREE    0
+
+#define AS_LD(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define AS_ST(p, v)  __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define AS_LDS(p)    __atomic_load_n(p, __ATOMIC_SEQ_CST)
+#define AS_STS(p, v) __atomic_store_n(p, v, __ATOMIC_SEQ_CST)
+
+
+/* One ring. Indices count up, wrapping at 2^32, and are masked for
+ * buf[]. Each side's line has its copy of the other side's index.
+ */
+struct as_ring {
+    /* consumer line */
+    uint32 head;            /* next entry to take */
+    uint32 tcache;          /* consumer copy of tail */
+    uint32 wait;            /* consumer sleeps on tail */
+    uint32 stat;            /* status, when head caught up with tail */
+    char pad1[AS_LINE - 4 * sizeof (uint32)];
+    /* producer line */
+    uint32 tail;            /* next entry to fill */
+    uint32 hcache;          /* producer copy of head */
+    char pad2[AS_LINE - 2 * sizeof (uint32)];
+    unsigned short buf[AS_SIZE];
+};
+
+struct as_slot {
+    uint32 state;           /* AS_FREE, or client pid */
+    char pad[AS_LINE - sizeof (uint32)];
+    struct as_ring cmd;     /* client to daemon */
+    struct as_ring res;     /* daemon to client: popped bytes */
+};
+
+struct as_hdr {
+    uint32 magic;           /* AS_MAGIC, once set up */
+    uint32 version;
+    uint32 nslot;
+    int32  pid;             /* daemon */
+    char pad1[AS_LINE - 4 * sizeof (uint32)];
+    /* daemon line */
+    uint32 bell;            /* daemon sleeps on this */
+    uint32 sleep;           /* daemon sleeps */
+    char pad2[AS_LINE - 2 * sizeof (uint32)];
+};
+
+#define AS_SLOT(h, i) ((struct as_slot *)((h) + 1) + (i))
+#define AS_BYTES(n)   (sizeof (struct as_hdr) + (n) * sizeof (struct as_slot))
+
+
+/* Sleep while *p is v, at most ms milliseconds (0: no limit), and
+ * wake up to n sleepers on p. Shared (not FUTEX_PRIVATE), as the
+ * sides are separate processes.
+ */
+static int as_sleep(uint32 *p, uint32 v, long ms) {
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    return syscall(SYS_futex, p, FUTEX_WAIT, v, ms ? &ts : NULL, NULL, 0);
+}
+
+static int as_wake(uint32 *p, int n) {
+    return syscall(SYS_futex, p, FUTEX_WAKE, n, NULL, NULL, 0);
+}
+
+#endif
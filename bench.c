@@ -0,0 +1,1037 @@
+/* bench.c
+ *
+ * Benchmark am9511 emulator.
+ *
+ * This is for the gcc (or tcc) host build only. It drives the emulator
+ * through the same am_push()/am_command()/am_pop() interface as test.c,
+ * and reports commands per second.
+ *
+ *   bench [-b] [-n rounds] [-w workers] [name ...]
+ *
+ * With no names, all benchmarks are run.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "getopt.h"
+#include "am9511.h"
+#include "ambank.h"
+#ifdef AM_RING
+#include "amring.h"
+#endif
+#ifdef AM_FARM
+#include "amfarm.h"
+#endif
+#include "floatcnv.h"
+#include "floatvec.h"
+#include "ova.h"
+#include "types.h"
+
+
+/* When rec is set, operations are recorded there as an am_exec()
+ * batch, instead of being done.
+ */
+static unsigned char *rec;
+
+/* When bulk is set, operands go through am_push16() etc. instead of
+ * byte at a time.
+ */
+static int bulk;
+
+/* When thru is set, pushf(), cmd() and popn() go to the chip thread
+ * (amring.c, built with -DAM_RING) through ring, instead.
+ */
+#ifdef AM_RING
+static void *ring;
+static int thru;
+#endif
+
+
+/* Push 16 bit, 32 bit and AM9511 float operands
+ */
+static void push16(void *am9511, int16 n) {
+    if (rec != NULL) {
+	*rec++ = AM_XPUSH;
+	*rec++ = 2;
+	*rec++ = n;
+	*rec++ = n >> 8;
+	return;
+    }
+    if (bulk) {
+	am_push16(am9511, n);
+	return;
+    }
+    am_push(am9511, n);
+    am_push(am9511, n >> 8);
+}
+
+static void push32(void *am9511, int32 n) {
+    if (rec != NULL) {
+	*rec++ = AM_XPUSH;
+	*rec++ = 4;
+	*rec++ = n;
+	*rec++ = n >> 8;
+	*rec++ = n >> 16;
+	*rec++ = n >> 24;
+	return;
+    }
+    if (bulk) {
+	am_push32(am9511, n);
+	return;
+    }
+    am_push(am9511, n);
+    am_push(am9511, n >> 8);
+    am_push(am9511, n >> 16);
+    am_push(am9511, n >> 24);
+}
+
+static void pushf(void *am9511, unsigned char *v) {
+    if (rec != NULL) {
+	*rec++ = AM_XPUSH;
+	*rec++ = 4;
+	memcpy(rec, v, 4);
+	rec += 4;
+	return;
+    }
+#ifdef AM_RING
+    if (thru) {
+	ar_push(ring, v[0]);
+	ar_push(ring, v[1]);
+	ar_push(ring, v[2]);
+	ar_push(ring, v[3]);
+	return;
+    }
+#endif
+    if (bulk) {
+	am_pushf(am9511, v);
+	return;
+    }
+    am_push(am9511, v[0]);
+    am_push(am9511, v[1]);
+    am_push(am9511, v[2]);
+    am_push(am9511, v[3]);
+}
+
+
+/* Issue command
+ */
+static void cmd(void *am9511, unsigned char op) {
+    if (rec != NULL) {
+	*rec++ = AM_XCMD;
+	*rec++ = op;
+	return;
+    }
+#ifdef AM_RING
+    if (thru) {
+	ar_command(ring, op);
+	return;
+    }
+#endif
+    am_command(am9511, op);
+}
+
+
+/* Pop n bytes, and fold them into a checksum (so that the work is
+ * not optimized away).
+ */
+static unsigned sum;
+
+static void popn(void *am9511, int n) {
+    unsigned char b[4];
+
+    if (rec != NULL) {
+	*rec++ = AM_XPOP;
+	*rec++ = n;
+	return;
+    }
+#ifdef AM_RING
+    if (thru) {
+	while (n--)
+	    sum += ar_pop(ring);
+	return;
+    }
+#endif
+    if (bulk && n == 4) {
+	am_popf(am9511, b);
+	sum += b[0] + b[1] + b[2] + b[3];
+	return;
+    }
+    if (bulk && n == 2) {
+	n = am_pop16(am9511);
+	sum += (n & 0xff) + ((n >> 8) & 0xff);
+	return;
+    }
+    while (n--)
+	sum += am_pop(am9511);
+}
+
+
+/* test.c command mix -- one round of the commands issued by
+ * am_test1() .. am_test9(), without the printing. Returns number
+ * of commands.
+ */
+static long bmix(void *am9511) {
+    cmd(am9511, AM_NOP);
+
+    /* PUPI, CHSS, CHSD, CHSF */
+    cmd(am9511, AM_PUPI);
+    popn(am9511, 4);
+    push16(am9511, 2);
+    cmd(am9511, AM_CHS | AM_SINGLE);
+    popn(am9511, 2);
+    push16(am9511, -30);
+    cmd(am9511, AM_CHS | AM_SINGLE);
+    popn(am9511, 2);
+    push32(am9511, 2);
+    cmd(am9511, AM_CHS | AM_DOUBLE);
+    popn(am9511, 4);
+    push32(am9511, -30);
+    cmd(am9511, AM_CHS | AM_DOUBLE);
+    popn(am9511, 4);
+    cmd(am9511, AM_PUPI);
+    cmd(am9511, AM_CHSF);
+    popn(am9511, 4);
+
+    /* PTO, POP, XCH, FIXS, FIXD, FLTD, FLTS */
+    push16(am9511, 0x0201);
+    cmd(am9511, AM_PTO | AM_SINGLE);
+    cmd(am9511, AM_PTO | AM_DOUBLE);
+    cmd(am9511, AM_PTO | AM_FLOAT);
+    cmd(am9511, AM_POP | AM_FLOAT);
+    cmd(am9511, AM_POP | AM_DOUBLE);
+    cmd(am9511, AM_XCH | AM_DOUBLE);
+    cmd(am9511, AM_PUPI);
+    cmd(am9511, AM_PTO | AM_FLOAT);
+    cmd(am9511, AM_FIXS);
+    popn(am9511, 2);
+    cmd(am9511, AM_FIXD);
+    popn(am9511, 4);
+    cmd(am9511, AM_FLTD);
+    push16(am9511, 1000);
+    cmd(am9511, AM_FLTS);
+    cmd(am9511, AM_FIXS);
+    popn(am9511, 2);
+
+    /* ADD, SUB, MUL, MUU, DIV: SINGLE, DOUBLE and FLOAT */
+    push16(am9511, 1);
+    push16(am9511, 2);
+    cmd(am9511, AM_ADD | AM_SINGLE);
+    popn(am9511, 2);
+    push32(am9511, 1);
+    push32(am9511, 2);
+    cmd(am9511, AM_ADD | AM_DOUBLE);
+    popn(am9511, 4);
+    push16(am9511, 1);
+    cmd(am9511, AM_FLTS);
+    push16(am9511, 2);
+    cmd(am9511, AM_FLTS);
+    cmd(am9511, AM_FADD);
+    popn(am9511, 4);
+
+    push16(am9511, 1);
+    push16(am9511, 2);
+    cmd(am9511, AM_SUB | AM_SINGLE);
+    popn(am9511, 2);
+    push32(am9511, 1);
+    push32(am9511, 2);
+    cmd(am9511, AM_SUB | AM_DOUBLE);
+    popn(am9511, 4);
+    push16(am9511, 1);
+    cmd(am9511, AM_FLTS);
+    push16(am9511, 2);
+    cmd(am9511, AM_FLTS);
+    cmd(am9511, AM_FSUB);
+    popn(am9511, 4);
+
+    push16(am9511, 10);
+    push16(am9511, 3);
+    cmd(am9511, AM_DIV | AM_SINGLE);
+    popn(am9511, 2);
+    push32(am9511, 10);
+    push32(am9511, 3);
+    cmd(am9511, AM_DIV | AM_DOUBLE);
+    popn(am9511, 4);
+    push16(am9511, 10);
+    cmd(am9511, AM_FLTS);
+    push16(am9511, 3);
+    cmd(am9511, AM_FLTS);
+    cmd(am9511, AM_FDIV);
+    popn(am9511, 4);
+
+    push16(am9511, -3);
+    push16(am9511, 10);
+    cmd(am9511, AM_MUL | AM_SINGLE);
+    popn(am9511, 2);
+    push16(am9511, -3);
+    push16(am9511, 10);
+    cmd(am9511, AM_MUU | AM_SINGLE);
+    popn(am9511, 2);
+    push32(am9511, -3);
+    push32(am9511, -10);
+    cmd(am9511, AM_MUL | AM_DOUBLE);
+    popn(am9511, 4);
+    push32(am9511, -3);
+    push32(am9511, 10);
+    cmd(am9511, AM_MUU | AM_DOUBLE);
+    popn(am9511, 4);
+    push16(am9511, 10);
+    cmd(am9511, AM_FLTS);
+    push16(am9511, 3);
+    cmd(am9511, AM_FLTS);
+    cmd(am9511, AM_FMUL);
+    popn(am9511, 4);
+
+    return 43;
+}
+
+
+/* Integer and stack commands only -- no float conversions, so this
+ * is mostly command dispatch. Returns number of commands.
+ */
+static long bint(void *am9511) {
+    push32(am9511, 12345);
+    push32(am9511, -678);
+    cmd(am9511, AM_PTO | AM_DOUBLE);
+    cmd(am9511, AM_XCH | AM_DOUBLE);
+    cmd(am9511, AM_ADD | AM_DOUBLE);
+    cmd(am9511, AM_CHS | AM_DOUBLE);
+    cmd(am9511, AM_MUL | AM_DOUBLE);
+    cmd(am9511, AM_SUB | AM_DOUBLE);
+    cmd(am9511, AM_POP | AM_FLOAT);
+    push16(am9511, 99);
+    push16(am9511, 7);
+    cmd(am9511, AM_PTO | AM_SINGLE);
+    cmd(am9511, AM_XCH | AM_SINGLE);
+    cmd(am9511, AM_ADD | AM_SINGLE);
+    cmd(am9511, AM_MUU | AM_SINGLE);
+    cmd(am9511, AM_DIV | AM_SINGLE);
+    cmd(am9511, AM_CHS | AM_SINGLE);
+    popn(am9511, 2);
+    return 13;
+}
+
+
+/* FLTD FIXD FLTS FIXS over a run of integers (16 per round, spread
+ * over the range)
+ */
+static long bfix(void *am9511) {
+    static uint32 x = 1;
+    int i;
+
+    for (i = 0; i < 16; ++i) {
+	x = x * 69069UL + 1;
+	push32(am9511, (int32)x >> (i & 15));
+	cmd(am9511, AM_FLTD);
+	cmd(am9511, AM_FIXD);
+	popn(am9511, 4);
+	push16(am9511, (int16)(x >> 16) >> (i & 7));
+	cmd(am9511, AM_FLTS);
+	cmd(am9511, AM_FIXS);
+	popn(am9511, 2);
+    }
+    return 16 * 4;
+}
+
+
+/* AM9511 float operands
+ */
+static unsigned char f_pi[]  = { FW_BYTES(AM_PI_W) };
+static unsigned char f_5[]   = { FW_BYTES(FW_INT(AM, 5)) };
+static unsigned char f_p1[]  = { 0xcd, 0xcc, 0xcc, 0x7d }; /* 0.1 */
+static unsigned char f_m6[]  = { 0x51, 0x49, 0x9d, 0xf6 }; /* -0.0006 */
+static unsigned char f_mp6[] = { 0x99, 0x99, 0x99, 0x80 }; /* -0.6 */
+static unsigned char f_p9[]  = { 0x66, 0x66, 0xe6, 0x00 }; /* 0.9 */
+
+
+/* FADD FSUB FMUL FDIV (basicf) chain. Returns number of commands.
+ */
+static long bfp(void *am9511) {
+    pushf(am9511, f_pi);
+    pushf(am9511, f_5);
+    cmd(am9511, AM_FADD);
+    pushf(am9511, f_p1);
+    cmd(am9511, AM_FMUL);
+    pushf(am9511, f_m6);
+    cmd(am9511, AM_FDIV);
+    pushf(am9511, f_pi);
+    cmd(am9511, AM_FSUB);
+    popn(am9511, 4);
+    return 4;
+}
+
+
+/* One function on three operands. Returns number of commands.
+ */
+static long bfn(void *am9511, unsigned char op,
+		unsigned char *a, unsigned char *b, unsigned char *c) {
+    pushf(am9511, a);
+    am_command(am9511, op);
+    popn(am9511, 4);
+    pushf(am9511, b);
+    am_command(am9511, op);
+    popn(am9511, 4);
+    pushf(am9511, c);
+    am_command(am9511, op);
+    popn(am9511, 4);
+    return 3;
+}
+
+static long bsin(void *am9511) {
+    return bfn(am9511, AM_SIN, f_p1, f_5, f_pi);
+}
+
+static long bcos(void *am9511) {
+    return bfn(am9511, AM_COS, f_p1, f_5, f_pi);
+}
+
+static long btan(void *am9511) {
+    return bfn(am9511, AM_TAN, f_p1, f_5, f_pi);
+}
+
+static long batan(void *am9511) {
+    return bfn(am9511, AM_ATAN, f_p1, f_5, f_m6);
+}
+
+static long basin(void *am9511) {
+    return bfn(am9511, AM_ASIN, f_p1, f_mp6, f_p9);
+}
+
+static long bacos(void *am9511) {
+    return bfn(am9511, AM_ACOS, f_p1, f_mp6, f_p9);
+}
+
+static long bsqrt(void *am9511) {
+    return bfn(am9511, AM_SQRT, f_p1, f_5, f_pi);
+}
+
+static long bexp(void *am9511) {
+    return bfn(am9511, AM_EXP, f_p1, f_5, f_mp6);
+}
+
+static long bln(void *am9511) {
+    return bfn(am9511, AM_LN, f_p1, f_5, f_p9);
+}
+
+static long blog(void *am9511) {
+    return bfn(am9511, AM_LOG, f_p1, f_5, f_p9);
+}
+
+
+/* Chain of float commands, each on the result of the last.
+ * Returns number of commands.
+ */
+static long bchain(void *am9511) {
+    pushf(am9511, f_pi);
+    pushf(am9511, f_5);
+    cmd(am9511, AM_FMUL);
+    cmd(am9511, AM_SQRT);
+    pushf(am9511, f_p1);
+    cmd(am9511, AM_FADD);
+    cmd(am9511, AM_SIN);
+    pushf(am9511, f_5);
+    cmd(am9511, AM_FMUL);
+    cmd(am9511, AM_ATAN);
+    pushf(am9511, f_pi);
+    cmd(am9511, AM_FDIV);
+    popn(am9511, 4);
+    return 7;
+}
+
+
+/* PWR on three operand pairs. Returns number of commands.
+ */
+static long bpwr(void *am9511) {
+    pushf(am9511, f_5);
+    pushf(am9511, f_p1);
+    am_command(am9511, AM_PWR);
+    popn(am9511, 4);
+    pushf(am9511, f_pi);
+    pushf(am9511, f_mp6);
+    am_command(am9511, AM_PWR);
+    popn(am9511, 4);
+    pushf(am9511, f_p9);
+    pushf(am9511, f_5);
+    am_command(am9511, AM_PWR);
+    popn(am9511, 4);
+    return 3;
+}
+
+
+/* PWR, with guest work between the command and the status poll, as a
+ * guest program would do. "gpwr" is synchronous, "apwr" has the chip
+ * hand PWR to a worker thread (am9511.c built with -DAM_ASYNC), so
+ * the two can overlap on separate cores.
+ */
+#define GWORK 50
+
+static volatile unsigned gsink;
+
+static void guest(void) {
+    unsigned x = gsink;
+    int i;
+
+    for (i = 0; i < GWORK; ++i)
+	x = x * 69069 + 1;
+    gsink = x;
+}
+
+static long bgpwr(void *am9511) {
+    pushf(am9511, f_5);
+    pushf(am9511, f_p1);
+    am_command(am9511, AM_PWR);
+    guest();
+    while (am_status(am9511) & AM_BUSY)
+	;
+    popn(am9511, 4);
+    return 1;
+}
+
+#ifdef AM_ASYNC
+static long bapwr(void *am9511) {
+    long n;
+
+    am_async(am9511, 1);
+    n = bgpwr(am9511);
+    am_async(am9511, 0);
+    return n;
+}
+#endif
+
+
+/* Round trip (push a byte and pop it back), and a stream of FADDs
+ * with one pop at the end. "rtrip" "rstream" and "rfp" do "trip"
+ * "stream" and "fp" through the chip thread of amring.c, to compare
+ * the latency and throughput of the rings with direct calls.
+ */
+static long btrip(void *am9511) {
+#ifdef AM_RING
+    if (thru) {
+	ar_push(ring, sum);
+	sum += ar_pop(ring);
+	return 1;
+    }
+#endif
+    am_push(am9511, sum);
+    sum += am_pop(am9511);
+    return 1;
+}
+
+static long bstream(void *am9511) {
+    int i;
+
+    pushf(am9511, f_5);
+    for (i = 0; i < 16; ++i) {
+	pushf(am9511, f_p1);
+	cmd(am9511, AM_FADD);
+    }
+    popn(am9511, 4);
+    return 16;
+}
+
+#ifdef AM_RING
+static long bthru(void *am9511, long (*fn)(void *)) {
+    long n;
+
+    if (ring == NULL)
+	ring = ar_create(am9511);
+    thru = 1;
+    n = (*fn)(am9511);
+    thru = 0;
+    return n;
+}
+
+static long brtrip(void *am9511) {
+    return bthru(am9511, btrip);
+}
+
+static long brstream(void *am9511) {
+    return bthru(am9511, bstream);
+}
+
+static long brfp(void *am9511) {
+    return bthru(am9511, bfp);
+}
+#endif
+
+
+/* Chip churn: destroy one of NLIVE live chips and create another in
+ * its place, and give it a command. Returns number of chips created.
+ */
+#define NLIVE 64
+
+static void *live[NLIVE];
+static int nlive;
+
+static long bchurn(void *am9511) {
+    void *p;
+
+    am9511 = am9511;
+    am_destroy(live[nlive]);
+    p = am_create(-1, -1);
+    if (p == NULL) {
+	fprintf(stderr, "Cannot create\n");
+	exit(1);
+    }
+    live[nlive] = p;
+    nlive = (nlive + 1) % NLIVE;
+    am_command(p, AM_PUPI);
+    sum += am_pop(p);
+    return 1;
+}
+
+
+/* NCHIP chips, each given the same float sequence per round: one as
+ * separate chips, and one as an ab_run() bank.
+ */
+#define NCHIP 256
+
+static unsigned char bops[] = {
+    AM_FMUL, AM_PTO, AM_FADD, AM_CHSF, AM_PUPI, AM_FDIV, AM_POP
+};
+#define NBOPS (sizeof (bops) / sizeof (bops[0]))
+
+static void *chips[NCHIP];
+static void *bank;
+static struct ab_cmd bcmd[NCHIP * NBOPS];
+static unsigned char bstat[NCHIP * NBOPS];
+
+static long bchips(void *am9511) {
+    int i, j;
+
+    am9511 = am9511;
+    if (chips[0] == NULL)
+	for (i = 0; i < NCHIP; ++i)
+	    chips[i] = am_create(-1, -1);
+    for (i = 0; i < NCHIP; ++i) {
+	for (j = 0; j < 4; ++j)
+	    am_push(chips[i], f_pi[j]);
+	for (j = 0; j < 4; ++j)
+	    am_push(chips[i], f_5[j]);
+	for (j = 0; j < NBOPS; ++j)
+	    am_command(chips[i], bops[j]);
+	sum += am_status(chips[i]);
+    }
+    return NCHIP * NBOPS;
+}
+
+static long bbank(void *am9511) {
+    int i, j;
+
+    am9511 = am9511;
+    if (bank == NULL) {
+	bank = ab_create(NCHIP);
+	if (bank == NULL) {
+	    fprintf(stderr, "Cannot create\n");
+	    exit(1);
+	}
+	for (i = 0; i < NCHIP; ++i)
+	    for (j = 0; j < NBOPS; ++j) {
+		bcmd[i * NBOPS + j].chip = i;
+		bcmd[i * NBOPS + j].op = bops[j];
+	    }
+    }
+    for (i = 0; i < NCHIP; ++i) {
+	for (j = 0; j < 4; ++j)
+	    ab_push(bank, i, f_pi[j]);
+	for (j = 0; j < 4; ++j)
+	    ab_push(bank, i, f_5[j]);
+    }
+    ab_run(bank, bcmd, NCHIP * NBOPS, bstat);
+    for (i = 0; i < NCHIP; ++i)
+	sum += ab_status(bank, i);
+    return NCHIP * NBOPS;
+}
+
+
+/* NCNV AM9511 floats to IEEE: one at a time through struct fp, and as
+ * an fv_cnv() array
+ */
+#define NCNV 4096
+
+static unsigned char cnvin[4 * NCNV];
+static unsigned char cnvout[4 * NCNV];
+static unsigned char cnverr[NCNV / 8];
+
+static void cnvinit(void) {
+    int i;
+
+    if (cnvin[2] != 0)
+	return;
+    for (i = 0; i < NCNV; ++i) {
+	cnvin[4 * i] = i;
+	cnvin[4 * i + 1] = i * 7;
+	cnvin[4 * i + 2] = 0x80 | (i * 13);
+	cnvin[4 * i + 3] = i * 29;
+    }
+}
+
+static long bcnv(void *am9511) {
+    struct fp_buf fp;
+    int i;
+
+    am9511 = am9511;
+    cnvinit();
+    for (i = 0; i < NCNV; ++i) {
+	am_fp(cnvin + 4 * i, &fp);
+	sum += fp_ie(&fp, cnvout + 4 * i);
+    }
+    return NCNV;
+}
+
+static long bcnvv(void *am9511) {
+    am9511 = am9511;
+    cnvinit();
+    sum += fv_cnv(FV_IE, FV_AM, cnvout, cnvin, NCNV, cnverr);
+    return NCNV;
+}
+
+
+/* NOVA operand pairs through the ova.c kernels: add and subtract in
+ * two passes (add16() then oadd16() and so on, as am9511.c did), and
+ * one (sadd() and so on), and multiply. Build with -DOVA_BYTES to time
+ * the z80 code instead of 64 bit multiply and the overflow builtins.
+ */
+#define NOVA 1024
+
+static unsigned char ova_a[4 * NOVA];
+static unsigned char ova_b[4 * NOVA];
+static unsigned char ova_c[4 * NOVA];
+
+static void ovainit(void) {
+    unsigned long x = 1;
+    int i;
+
+    if (ova_a[0] != 0)
+	return;
+    for (i = 0; i < 4 * NOVA; ++i) {
+	x = x * 1103515245UL + 12345;
+	ova_a[i] = x >> 16;
+	ova_b[i] = x >> 24;
+    }
+    ova_a[0] |= 1;
+}
+
+#define OVA2(name, op, oop) \
+    static long name(void *am9511) { \
+	int i; \
+	am9511 = am9511; \
+	ovainit(); \
+	for (i = 0; i < 4 * NOVA; i += 4) { \
+	    sum += op(ova_a + i, ova_b + i, ova_c + i); \
+	    sum += oop(ova_a + i, ova_b + i, ova_c + i); \
+	} \
+	return NOVA; \
+    }
+
+#define OVA1(name, op) \
+    static long name(void *am9511) { \
+	int i; \
+	am9511 = am9511; \
+	ovainit(); \
+	for (i = 0; i < 4 * NOVA; i += 4) \
+	    sum += op(ova_a + i, ova_b + i, ova_c + i); \
+	return NOVA; \
+    }
+
+OVA2(badd16, add16, oadd16)
+OVA2(badd32, add32, oadd32)
+OVA2(bsub16, sub16, osub16)
+OVA2(bsub32, sub32, osub32)
+OVA1(bsadd, sadd)
+OVA1(bdadd, dadd)
+OVA1(bssub, ssub)
+OVA1(bdsub, dsub)
+OVA1(bmull16, mull16)
+OVA1(bmulu16, mulu16)
+OVA1(bmull32, mull32)
+OVA1(bmulu32, mulu32)
+
+
+/* Run benchmark fn as one am_exec() batch per round. The batch is
+ * recorded into buf (n bytes) on first use. Returns number of
+ * commands.
+ */
+struct batch {
+    unsigned char buf[512];
+    int n;
+    long cmds;
+};
+
+static unsigned char outb[256];
+
+static long xrun(void *am9511, long (*fn)(void *), struct batch *b) {
+    int i, n;
+
+    if (b->n == 0) {
+	rec = b->buf;
+	b->cmds = (*fn)(am9511);
+	b->n = rec - b->buf;
+	rec = NULL;
+    }
+    n = am_exec(am9511, b->buf, b->n, outb);
+    for (i = 0; i < n; ++i)
+	sum += outb[i];
+    return b->cmds;
+}
+
+static struct batch xmix, xint, xfp;
+
+static long bxmix(void *am9511) {
+    return xrun(am9511, bmix, &xmix);
+}
+
+static long bxint(void *am9511) {
+    return xrun(am9511, bint, &xint);
+}
+
+static long bxfp(void *am9511) {
+    return xrun(am9511, bfp, &xfp);
+}
+
+
+/* Chip farm (amfarm.c, built with -DAM_FARM): each round, one job for
+ * each of NCHIP chips, the chain as an am_exec() batch (four times
+ * over for every fifth chip, so that the work is uneven). "farm" runs
+ * them on a farm of -w workers, "farmd" on this thread, one chip
+ * after another.
+ */
+static int workers;
+
+#ifdef AM_FARM
+static void *farm;
+static void *fchips[NCHIP];
+static struct af_job fjob[NCHIP];
+static unsigned char fout[NCHIP][4];
+static struct batch xchain, xchain4;
+static long fcmds;
+
+static void fsetup(void *am9511) {
+    struct batch *b;
+    int i;
+
+    rec = xchain.buf;
+    xchain.cmds = bchain(am9511);
+    xchain.n = rec - xchain.buf;
+    rec = xchain4.buf;
+    for (i = 0; i < 4; ++i)
+	xchain4.cmds += bchain(am9511);
+    xchain4.n = rec - xchain4.buf;
+    rec = NULL;
+    for (i = 0; i < NCHIP; ++i) {
+	b = (i % 5 == 0) ? &xchain4 : &xchain;
+	fchips[i] = am_create(-1, -1);
+	fjob[i].in = b->buf;
+	fjob[i].n = b->n;
+	fjob[i].out = fout[i];
+	fcmds += b->cmds;
+    }
+}
+
+static long bfarm(void *am9511) {
+    int i;
+
+    if (xchain.n == 0)
+	fsetup(am9511);
+    if (farm == NULL) {
+	farm = af_create(workers, NCHIP);
+	for (i = 0; i < NCHIP; ++i)
+	    af_add(farm, fchips[i]);
+    }
+    for (i = 0; i < NCHIP; ++i)
+	af_submit(farm, i, &fjob[i]);
+    af_drain(farm);
+    for (i = 0; i < NCHIP; ++i)
+	sum += fout[i][0];
+    return fcmds;
+}
+
+static long bfarmd(void *am9511) {
+    int i;
+
+    if (xchain.n == 0)
+	fsetup(am9511);
+    for (i = 0; i < NCHIP; ++i) {
+	am_exec(fchips[i], fjob[i].in, fjob[i].n, fout[i]);
+	sum += fout[i][0];
+    }
+    return fcmds;
+}
+#endif
+
+
+struct bench {
+    char *name;
+    long (*fn)(void *);
+    char *desc;
+};
+
+static struct bench benches[] = {
+    { "mix",    bmix,    "test.c command mix" },
+    { "int",    bint,    "integer and stack commands" },
+    { "xmix",   bxmix,   "mix, as am_exec() batches" },
+    { "xint",   bxint,   "int, as am_exec() batches" },
+    { "xfp",    bxfp,    "fp, as am_exec() batches" },
+    { "fp",     bfp,     "FADD FSUB FMUL FDIV" },
+    { "fix",    bfix,    "FLTD FIXD FLTS FIXS" },
+    { "sin",    bsin,    "SIN" },
+    { "cos",    bcos,    "COS" },
+    { "tan",    btan,    "TAN" },
+    { "atan",   batan,   "ATAN" },
+    { "asin",   basin,   "ASIN" },
+    { "acos",   bacos,   "ACOS" },
+    { "sqrt",   bsqrt,   "SQRT" },
+    { "exp",    bexp,    "EXP" },
+    { "ln",     bln,     "LN" },
+    { "log",    blog,    "LOG" },
+    { "pwr",    bpwr,    "PWR" },
+    { "gpwr",   bgpwr,   "PWR with guest work" },
+#ifdef AM_ASYNC
+    { "apwr",   bapwr,   "PWR with guest work, async" },
+#endif
+    { "trip",   btrip,   "push and pop one byte" },
+    { "stream", bstream, "16 FADD, one result popped" },
+#ifdef AM_RING
+    { "rtrip",  brtrip,  "trip, through amring.c rings" },
+    { "rstream", brstream, "stream, through amring.c rings" },
+    { "rfp",    brfp,    "fp, through amring.c rings" },
+#endif
+    { "chain",  bchain,  "FMUL SQRT FADD SIN FMUL ATAN FDIV chain" },
+#ifdef AM_FARM
+    { "farm",   bfarm,   "chain on 256 chips, uneven, amfarm.c farm" },
+    { "farmd",  bfarmd,  "farm jobs, am_exec() on this thread" },
+#endif
+    { "churn",  bchurn,  "am_create() and am_destroy(), 64 live" },
+    { "chips",  bchips,  "float sequence on 256 chips, one at a time" },
+    { "bank",   bbank,   "float sequence on 256 chips, as ab_run() bank" },
+    { "cnv",    bcnv,    "AM9511 to IEEE, am_fp() and fp_ie()" },
+    { "cnvv",   bcnvv,   "AM9511 to IEEE, fv_cnv() array" },
+    { "add16",  badd16,  "add16() and oadd16()" },
+    { "sadd",   bsadd,   "sadd()" },
+    { "add32",  badd32,  "add32() and oadd32()" },
+    { "dadd",   bdadd,   "dadd()" },
+    { "sub16",  bsub16,  "sub16() and osub16()" },
+    { "ssub",   bssub,   "ssub()" },
+    { "sub32",  bsub32,  "sub32() and osub32()" },
+    { "dsub",   bdsub,   "dsub()" },
+    { "mull16", bmull16, "mull16() (SMUL)" },
+    { "mulu16", bmulu16, "mulu16() (SMUU)" },
+    { "mull32", bmull32, "mull32() (DMUL)" },
+    { "mulu32", bmulu32, "mulu32() (DMUU)" },
+    { NULL,     NULL,    NULL }
+};
+
+
+/* Wall clock seconds (not clock(), which adds up the CPU time of all
+ * threads, and would hide any overlap with am_async() workers)
+ */
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Run one benchmark for the given number of rounds.
+ */
+static void run(struct bench *b, void *am9511, long rounds) {
+    double t0, secs;
+    long i, cmds;
+
+    cmds = 0;
+    t0 = now();
+    for (i = 0; i < rounds; ++i)
+	cmds += (*b->fn)(am9511);
+    secs = now() - t0;
+    if (secs <= 0.0)
+	secs = 1e-9;
+    printf("%-8s %10ld cmds %8.3f s %12.0f cmds/s %8.2f ns  (%s)\n",
+	   b->name, cmds, secs, cmds / secs, secs * 1e9 / cmds, b->desc);
+}
+
+
+/* Give usage for am9511 benchmark
+ */
+static void usage(char *p) {
+    struct bench *b;
+
+    printf("usage: %s [-b] [-n rounds] [-w workers] [name ...]\n", p);
+    printf("    -b         push and pop with am_push16() etc.\n");
+    printf("    -n rounds  rounds per benchmark (default 1000000)\n");
+    printf("    -w workers farm workers (default one per CPU)\n");
+    printf("\n");
+    for (b = benches; b->name != NULL; ++b)
+	printf("    %-8s %s\n", b->name, b->desc);
+    exit(1);
+}
+
+
+int main(int ac, char **av) {
+    int ch, i;
+    long rounds;
+    void *am9511;
+    struct bench *b;
+
+    rounds = 1000000;
+    while ((ch = getopt(ac, av, "bn:w:")) != EOF)
+	switch (ch) {
+	case 'b':
+	    bulk = 1;
+	    break;
+	case 'n':
+	    rounds = atol(optarg);
+	    break;
+	case 'w':
+	    workers = atoi(optarg);
+	    break;
+	case '?':
+	default:
+	    usage(av[0]);
+	}
+    ac -= optind;
+    av += optind;
+
+    am9511 = am_create(-1, -1);
+    if (am9511 == NULL) {
+	fprintf(stderr, "Cannot create\n");
+	return 1;
+    }
+
+    for (b = benches; b->name != NULL; ++b) {
+	if (ac > 0) {
+	    for (i = 0; i < ac; ++i)
+		if (strcmp(av[i], b->name) == 0)
+		    break;
+	    if (i == ac)
+		continue;
+	}
+	am_reset(am9511);
+	run(b, am9511, rounds);
+#ifdef AM_RING
+	if (ring != NULL)
+	    ar_sync(ring);          /* chip thread done with am9511 */
+#endif
+    }
+
+#ifdef AM_POOL
+    if (live[0] != NULL) {
+	unsigned long used, slots;
+
+	am_pool(&used, &slots);
+	printf("pool: %lu of %lu slots in use\n", used, slots);
+    }
+#endif
+
+#ifdef AM_FARM
+    if (farm != NULL)
+	printf("farm: %d workers, %lu steals\n", af_workers(farm),
+	       af_steals(farm));
+#endif
+
+    if (sum == 0)
+	printf("\n");
+    return 0;
+}
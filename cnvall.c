@@ -0,0 +1,324 @@
+/* cnvall.c
+ *
+ * Check float conversions on every 32 bit pattern (host only).
+ *
+ *   cnvall [-t threads] [-k step] [from:to ...]
+ *
+ * For each pair of formats (all twelve, or those given as ie:am and
+ * so on), every 32 bit word is converted by fv_cnv() (floatvec.c) and
+ * by the direct converter (am_ie() etc.), and each is compared with
+ * the two steps through struct fp (am_fp() then fp_ie()): bytes and
+ * FP_ERR. Words that convert are converted back (two steps), and
+ * those that do not come back as they went in (after the same two
+ * steps from and to their own format, which only cleans up zeros) are
+ * counted as round trip losses. These are not errors: the formats
+ * have different ranges.
+ *
+ * The words are split into chunks, which threads take in turn. With
+ * -k step, only every step'th chunk is done (a quick check), and word
+ * n of the chunks is n times an odd constant, so that a step that is
+ * a power of two does not leave some bits always 0. Reported
+ * rates are conversions per second per thread (thread CPU time), for
+ * each of fv_cnv(), the direct converter, and the two steps.
+ *
+ * Exit status is 1 if anything did not match. Needs POSIX threads, and
+ * takes getopt() from unistd.h (not getopt.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "floatcnv.h"
+#include "floatvec.h"
+#include "types.h"
+
+
+#define CHUNK    65536UL               /* words per chunk */
+#define NCHUNK   (0x100000000ULL / CHUNK)
+
+
+typedef int cnv_fn(void *, void *);
+
+static char *fname[4] = { "ie", "ms", "hi", "am" };
+
+/* Formats in FV_IE .. FV_AM order
+ */
+static cnv_fn *to_fp[4] = { ie_fp, ms_fp, hi_fp, am_fp };
+static cnv_fn *fp_to[4] = { fp_ie, fp_ms, fp_hi, fp_am };
+static cnv_fn *direct[4][4] = {   /* [from][to] */
+    { NULL,  ie_ms, ie_hi, ie_am },
+    { ms_ie, NULL,  ms_hi, ms_am },
+    { hi_ie, hi_ms, NULL,  hi_am },
+    { am_ie, am_ms, am_hi, NULL  }
+};
+
+
+/* One pair being checked. Threads take chunks under lock, and add
+ * their counts under lock when done.
+ */
+struct pair {
+    int from, to;
+    unsigned long long next;           /* next chunk */
+    unsigned long long words;
+    unsigned long long errs;           /* FP_ERR (two steps) */
+    unsigned long long bad_vec;        /* fv_cnv() mismatches */
+    unsigned long long bad_dir;        /* direct mismatches */
+    unsigned long long lost;           /* round trip losses */
+    double t_vec, t_dir, t_two;        /* thread seconds */
+    unsigned long long first;          /* first mismatch word */
+    int have_first;
+    pthread_mutex_t lock;
+};
+
+static int step = 1;
+
+
+/* Word i of chunk c. With -k, index times an odd constant: all words,
+ * in a different order, so the sample has every bit pattern.
+ */
+static uint32 word(unsigned long long c, unsigned long i) {
+    uint32 w = (uint32)(c * CHUNK + i);
+
+    return (step > 1) ? (uint32)(w * 0x9e3779b1UL) : w;
+}
+
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/* Two steps through struct fp. Returns FP_OK or FP_ERR.
+ */
+static int two(int from, int to, unsigned char *s, unsigned char *d) {
+    struct fp_buf fp;
+    int r;
+
+    r = (*to_fp[from])(s, &fp);
+    if ((*fp_to[to])(&fp, d) != FP_OK)
+	r = FP_ERR;
+    return r;
+}
+
+
+static void *worker(void *arg) {
+    struct pair *p = (struct pair *)arg;
+    unsigned char *src, *vec, *dir, *ref, *vbits, *derr, *rerr;
+    unsigned char back[4], same[4];
+    unsigned long long c, words = 0, errs = 0;
+    unsigned long long bad_vec = 0, bad_dir = 0, lost = 0, first = 0;
+    double t_vec = 0.0, t_dir = 0.0, t_two = 0.0, t;
+    unsigned long i;
+    int e, have_first = 0;
+    cnv_fn *fn = direct[p->from][p->to];
+
+    src = malloc(4 * CHUNK);
+    vec = malloc(4 * CHUNK);
+    dir = malloc(4 * CHUNK);
+    ref = malloc(4 * CHUNK);
+    vbits = malloc(CHUNK / 8);
+    derr = malloc(CHUNK);
+    rerr = malloc(CHUNK);
+    if ((src == NULL) || (vec == NULL) || (dir == NULL) || (ref == NULL) ||
+	(vbits == NULL) || (derr == NULL) || (rerr == NULL)) {
+	fprintf(stderr, "cannot allocate\n");
+	exit(2);
+    }
+
+    for (;;) {
+	pthread_mutex_lock(&p->lock);
+	c = p->next;
+	p->next += step;
+	pthread_mutex_unlock(&p->lock);
+	if (c >= NCHUNK)
+	    break;
+
+	for (i = 0; i < CHUNK; ++i)
+	    fw_st(src + 4 * i, word(c, i));
+
+	t = now();
+	fv_cnv(p->to, p->from, vec, src, CHUNK, vbits);
+	t_vec += now() - t;
+
+	t = now();
+	for (i = 0; i < CHUNK; ++i)
+	    derr[i] = (*fn)(src + 4 * i, dir + 4 * i);
+	t_dir += now() - t;
+
+	t = now();
+	for (i = 0; i < CHUNK; ++i)
+	    rerr[i] = two(p->from, p->to, src + 4 * i, ref + 4 * i);
+	t_two += now() - t;
+
+	for (i = 0; i < CHUNK; ++i) {
+	    e = rerr[i] != FP_OK;
+	    errs += e;
+	    if ((((vbits[i >> 3] >> (i & 7)) & 1) != e) ||
+		(memcmp(vec + 4 * i, ref + 4 * i, 4) != 0)) {
+		++bad_vec;
+		if (!have_first || (word(c, i) < first))
+		    first = word(c, i);
+		have_first = 1;
+	    }
+	    if ((derr[i] != rerr[i]) ||
+		(memcmp(dir + 4 * i, ref + 4 * i, 4) != 0)) {
+		++bad_dir;
+		if (!have_first || (word(c, i) < first))
+		    first = word(c, i);
+		have_first = 1;
+	    }
+	    if (e)
+		continue;
+	    two(p->from, p->from, src + 4 * i, same);
+	    if ((two(p->to, p->from, ref + 4 * i, back) != FP_OK) ||
+		(memcmp(back, same, 4) != 0))
+		++lost;
+	}
+	words += CHUNK;
+    }
+
+    pthread_mutex_lock(&p->lock);
+    p->words += words;
+    p->errs += errs;
+    p->bad_vec += bad_vec;
+    p->bad_dir += bad_dir;
+    p->lost += lost;
+    p->t_vec += t_vec;
+    p->t_dir += t_dir;
+    p->t_two += t_two;
+    if (have_first && (!p->have_first || (first < p->first))) {
+	p->first = first;
+	p->have_first = 1;
+    }
+    pthread_mutex_unlock(&p->lock);
+
+    free(src);
+    free(vec);
+    free(dir);
+    free(ref);
+    free(vbits);
+    free(derr);
+    free(rerr);
+    return NULL;
+}
+
+
+/* Check one pair with n threads. Returns 1 if anything did not match.
+ */
+static int check(int from, int to, int n) {
+    struct pair p;
+    pthread_t *tid;
+    int i;
+
+    memset(&p, 0, sizeof (p));
+    p.from = from;
+    p.to = to;
+    pthread_mutex_init(&p.lock, NULL);
+    tid = malloc(n * sizeof (pthread_t));
+    if (tid == NULL) {
+	fprintf(stderr, "cannot allocate\n");
+	exit(2);
+    }
+    for (i = 0; i < n; ++i)
+	if (pthread_create(&tid[i], NULL, worker, &p) != 0) {
+	    fprintf(stderr, "cannot create thread\n");
+	    exit(2);
+	}
+    for (i = 0; i < n; ++i)
+	pthread_join(tid[i], NULL);
+    free(tid);
+    pthread_mutex_destroy(&p.lock);
+
+    printf("%s:%s %11llu words %11llu FP_ERR %11llu lost %6llu/%llu bad "
+	   "%7.1f %6.1f %6.1f M/s\n",
+	   fname[from], fname[to], p.words, p.errs, p.lost,
+	   p.bad_vec, p.bad_dir,
+	   p.words / (p.t_vec + 1e-9) / 1e6,
+	   p.words / (p.t_dir + 1e-9) / 1e6,
+	   p.words / (p.t_two + 1e-9) / 1e6);
+    if (p.have_first)
+	printf("    first mismatch %08llx\n", p.first);
+    fflush(stdout);
+    return p.have_first;
+}
+
+
+static int fmt(char *s) {
+    int i;
+
+    for (i = 0; i < 4; ++i)
+	if (strcmp(s, fname[i]) == 0)
+	    return i;
+    return -1;
+}
+
+
+static void usage(char *p) {
+    printf("usage: %s [-t threads] [-k step] [from:to ...]\n", p);
+    printf("    -t threads  threads (default: one per CPU)\n");
+    printf("    -k step     do every step'th chunk of %lu words, spread over\n"
+	   "                all bits (word index times an odd constant)\n", CHUNK);
+    printf("    from:to     formats ie ms hi am (default: all pairs)\n");
+    exit(1);
+}
+
+
+int main(int ac, char **av) {
+    int ch, i, f, t, n, bad;
+    char *c, *prog = av[0];
+    time_t t0;
+
+    n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    while ((ch = getopt(ac, av, "t:k:")) != EOF)
+	switch (ch) {
+	case 't':
+	    n = atoi(optarg);
+	    break;
+	case 'k':
+	    step = atoi(optarg);
+	    break;
+	case '?':
+	default:
+	    usage(prog);
+	}
+    ac -= optind;
+    av += optind;
+    if (n < 1)
+	n = 1;
+    if (step < 1)
+	step = 1;
+
+    printf("%d threads, %s kernels, every %d of %llu chunks\n",
+	   n, fv_kern(NULL), step, (unsigned long long)NCHUNK);
+    printf("pair        words      FP_ERR        lost  vec/dir bad "
+	   "    vec    dir    two\n");
+    t0 = time(NULL);
+    bad = 0;
+    if (ac == 0) {
+	for (f = 0; f < 4; ++f)
+	    for (t = 0; t < 4; ++t)
+		if (f != t)
+		    bad |= check(f, t, n);
+    } else
+	for (i = 0; i < ac; ++i) {
+	    c = strchr(av[i], ':');
+	    if (c == NULL)
+		usage(prog);
+	    *c = '\0';
+	    f = fmt(av[i]);
+	    t = fmt(c + 1);
+	    if ((f < 0) || (t < 0) || (f == t))
+		usage(prog);
+	    bad |= check(f, t, n);
+	}
+    printf("%ld s, %s\n", (long)(time(NULL) - t0),
+	   bad ? "MISMATCHES" : "all match");
+    return bad;
+}
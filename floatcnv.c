@@ -59,6 +59,10 @@ struct fp {
     uint8  mantissa_h;
 };
 
+/* struct fp_buf (floatcnv.h) must be big enough
+ */
+typedef char fp_chk[(sizeof (struct fp) <= sizeof (struct fp_buf)) ? 1 : -1];
+
 
 /* memset() is broken with HI-TECH C.
  * The memset() issue prompts us to write and use clear() instead. We avoid
@@ -383,9 +387,9 @@ int fp_ms(void *fpp, void *p) {
 
     /* Replace leading '1' with sign.
      */
-    m_l &= 0x7f;
+    m_h &= 0x7f;
     if (s)
-        m_l |= 0x80;
+        m_h |= 0x80;
 
     /* Build up output.
      */
@@ -550,3 +554,53 @@ size_t fp_size(void) {
     return sizeof (struct fp);
 }
 
+
+/* Direct conversions, format to format: am_ie() gives the same bytes
+ * and result as am_fp() then fp_ie(), and so on. On the host, this is
+ * one ff_cnv() on the 32 bit word (floatfmt.h). On z80, where 32 bit
+ * arithmetic is library calls, it is the two steps through a struct fp
+ * on the stack.
+ */
+#ifndef z80
+#define PAIR(name, to, from, dec, enc) \
+int name(void *p, void *q) { \
+    unsigned char *a = (unsigned char *)p; \
+    unsigned char *b = (unsigned char *)q; \
+    uint32 w; \
+    int err; \
+    w = (uint32)a[I0] | ((uint32)a[I1] << 8) | \
+        ((uint32)a[I2] << 16) | ((uint32)a[I3] << 24); \
+    w = ff_cnv(&ff_fmt[to], &ff_fmt[from], w, &err); \
+    b[I0] = w & 0xff; \
+    b[I1] = (w >> 8) & 0xff; \
+    b[I2] = (w >> 16) & 0xff; \
+    b[I3] = (w >> 24) & 0xff; \
+    return err ? FP_ERR : FP_OK; \
+}
+#else
+#define PAIR(name, to, from, dec, enc) \
+int name(void *p, void *q) { \
+    struct fp t; \
+    int r; \
+    r = dec(p, &t); \
+    if (enc(&t, q) != FP_OK) \
+        r = FP_ERR; \
+    return r; \
+}
+#endif
+
+/* Format numbers are the ff_fmt[] (floatfmt.h) order
+ */
+PAIR(ie_ms, 1, 0, ie_fp, fp_ms)
+PAIR(ie_hi, 2, 0, ie_fp, fp_hi)
+PAIR(ie_am, 3, 0, ie_fp, fp_am)
+PAIR(ms_ie, 0, 1, ms_fp, fp_ie)
+PAIR(ms_hi, 2, 1, ms_fp, fp_hi)
+PAIR(ms_am, 3, 1, ms_fp, fp_am)
+PAIR(hi_ie, 0, 2, hi_fp, fp_ie)
+PAIR(hi_ms, 1, 2, hi_fp, fp_ms)
+PAIR(hi_am, 3, 2, hi_fp, fp_am)
+PAIR(am_ie, 0, 3, am_fp, fp_ie)
+PAIR(am_ms, 1, 3, am_fp, fp_ms)
+PAIR(am_hi, 2, 3, am_fp, fp_hi)
+
@@ -53,4 +53,161 @@ void fp_put(void *,        /* set fp fields */
 	    unsigned int mantissa_l);
 size_t fp_size(void);      /* size of struct fp */
 
+/* Direct conversions, same as the two steps through fp
+ */
+int ie_ms(void *, void *); /* ieee to microsoft */
+int ie_hi(void *, void *); /* ieee to hitech */
+int ie_am(void *, void *); /* ieee to am9511 */
+int ms_ie(void *, void *); /* microsoft to ieee */
+int ms_hi(void *, void *); /* microsoft to hitech */
+int ms_am(void *, void *); /* microsoft to am9511 */
+int hi_ie(void *, void *); /* hitech to ieee */
+int hi_ms(void *, void *); /* hitech to microsoft */
+int hi_am(void *, void *); /* hitech to am9511 */
+int am_ie(void *, void *); /* am9511 to ieee */
+int am_ms(void *, void *); /* am9511 to microsoft */
+int am_hi(void *, void *); /* am9511 to hitech */
+
+/* Compile time conversions. These are constant expressions (for
+ * static tables, case labels and #if), made only of long shifts, masks
+ * and compares, so the z80 compiler folds them too. A float is a 32
+ * bit word, as fw_ld() below: byte I0 in bits 0..7.
+ *
+ * FW_IE(s, e, m) etc. make a word from struct fp fields: sign s (0 or
+ * 1), exponent e (value is 1.m * 2^e) and 24 bit mantissa m, leading 1
+ * at bit 23 (if it is 0, the word is 0.0). e is not range checked: it
+ * must fit the format, as fp_ie() and the like would check.
+ *
+ * FW_AM_S(w), FW_AM_E(w), FW_AM_M(w) etc. take a word apart, as
+ * am_fp() and the like. IEEE NAN and infinity are not handled.
+ *
+ * FW_CNV(IE, AM, w) converts word w from AM9511 to IEEE, and so on.
+ * FW_INT(AM, n) is integer n as AM9511 (|n| < 2^24, so exact).
+ * FW_BYTES(w) is the 4 bytes of w, I0 first, for an initializer.
+ */
+#define FW_Z(m)      (((unsigned long)(m) >> 23) & 1)
+#define FW_IE(s, e, m) \
+    ((((unsigned long)(s) << 31) | \
+      (((unsigned long)((e) + 127) & 0xff) << 23) | \
+      ((unsigned long)(m) & 0x7fffffL)) * FW_Z(m))
+#define FW_MS(s, e, m) \
+    (((((unsigned long)((e) + 129) & 0xff) << 24) | \
+      ((unsigned long)(s) << 23) | \
+      ((unsigned long)(m) & 0x7fffffL)) * FW_Z(m))
+#define FW_HI(s, e, m) \
+    ((((unsigned long)(s) << 31) | \
+      (((unsigned long)((e) + 65) & 0x7f) << 24) | \
+      ((unsigned long)(m) & 0xffffffL)) * FW_Z(m))
+#define FW_AM(s, e, m) \
+    ((((unsigned long)(s) << 31) | \
+      (((unsigned long)((e) + 1) & 0x7f) << 24) | \
+      ((unsigned long)(m) & 0xffffffL)) * FW_Z(m))
+
+#define FW_IE_S(w)   (((unsigned long)(w) >> 31) & 1)
+#define FW_IE_E(w)   ((long)(((unsigned long)(w) >> 23) & 0xff) - 127)
+#define FW_IE_M(w)   ((((unsigned long)(w) >> 23) & 0xff) ? \
+		      (((unsigned long)(w) & 0x7fffffL) | 0x800000L) : 0)
+#define FW_MS_S(w)   (((unsigned long)(w) >> 23) & 1)
+#define FW_MS_E(w)   ((long)(((unsigned long)(w) >> 24) & 0xff) - 129)
+#define FW_MS_M(w)   ((((unsigned long)(w) >> 24) & 0xff) ? \
+		      (((unsigned long)(w) & 0x7fffffL) | 0x800000L) : 0)
+#define FW_HI_S(w)   (((unsigned long)(w) >> 31) & 1)
+#define FW_HI_E(w)   ((long)(((unsigned long)(w) >> 24) & 0x7f) - 65)
+#define FW_HI_M(w)   (((unsigned long)(w) & 0x800000L) ? \
+		      ((unsigned long)(w) & 0xffffffL) : 0)
+#define FW_AM_S(w)   (((unsigned long)(w) >> 31) & 1)
+#define FW_AM_E(w)   ((long)((((unsigned long)(w) >> 24) & 0x7f) ^ 0x40) - 0x40 - 1)
+#define FW_AM_M(w)   (((unsigned long)(w) & 0x800000L) ? \
+		      ((unsigned long)(w) & 0xffffffL) : 0)
+
+#define FW_CNV(t, f, w) \
+    FW_##t(FW_##f##_S(w), FW_##f##_E(w), FW_##f##_M(w))
+
+/* floor(log2(n)) for 0 < n < 2^24, and 0 for 0
+ */
+#define FW_LG(n) \
+    (((n) >= 0x2L) + ((n) >= 0x4L) + ((n) >= 0x8L) + ((n) >= 0x10L) + \
+     ((n) >= 0x20L) + ((n) >= 0x40L) + ((n) >= 0x80L) + ((n) >= 0x100L) + \
+     ((n) >= 0x200L) + ((n) >= 0x400L) + ((n) >= 0x800L) + \
+     ((n) >= 0x1000L) + ((n) >= 0x2000L) + ((n) >= 0x4000L) + \
+     ((n) >= 0x8000L) + ((n) >= 0x10000L) + ((n) >= 0x20000L) + \
+     ((n) >= 0x40000L) + ((n) >= 0x80000L) + ((n) >= 0x100000L) + \
+     ((n) >= 0x200000L) + ((n) >= 0x400000L) + ((n) >= 0x800000L))
+#define FW_ABS(n)    ((n) < 0 ? -(long)(n) : (long)(n))
+#define FW_INT(t, n) \
+    FW_##t((n) < 0, FW_LG(FW_ABS(n)), \
+	   (unsigned long)FW_ABS(n) << (23 - FW_LG(FW_ABS(n))))
+
+#define FW_BYTES(w) \
+    (unsigned char)((w) & 0xff), (unsigned char)(((w) >> 8) & 0xff), \
+    (unsigned char)(((w) >> 16) & 0xff), (unsigned char)(((w) >> 24) & 0xff)
+
+
+#ifndef z80
+
+/* Typed conversions (host only, all inline). A float is a uint32 word
+ * (byte 0 in bits 0..7, as the I0..I3 bytes of floatcnv.c on a little
+ * endian host), and the taken apart float is a struct fpval value.
+ * ie_val() does what ie_fp() does, val_ie() what fp_ie() does (err,
+ * if not NULL, gets 1 for FP_ERR), and so on.
+ */
+#include <string.h>
+
+#include "floatfmt.h"
+
+FF_INLINE struct fpval ie_val(uint32 w) { return ff_get(&ff_fmt[0], w); }
+FF_INLINE struct fpval ms_val(uint32 w) { return ff_get(&ff_fmt[1], w); }
+FF_INLINE struct fpval hi_val(uint32 w) { return ff_get(&ff_fmt[2], w); }
+FF_INLINE struct fpval am_val(uint32 w) { return ff_get(&ff_fmt[3], w); }
+
+FF_INLINE uint32 val_ie(struct fpval v, int *err) {
+    return ff_put(&ff_fmt[0], v, err);
+}
+FF_INLINE uint32 val_ms(struct fpval v, int *err) {
+    return ff_put(&ff_fmt[1], v, err);
+}
+FF_INLINE uint32 val_hi(struct fpval v, int *err) {
+    return ff_put(&ff_fmt[2], v, err);
+}
+FF_INLINE uint32 val_am(struct fpval v, int *err) {
+    return ff_put(&ff_fmt[3], v, err);
+}
+
+/* Word from 4 bytes at p, and back
+ */
+FF_INLINE uint32 fw_ld(const void *p) {
+    const unsigned char *b = (const unsigned char *)p;
+    return (uint32)b[0] | ((uint32)b[1] << 8) |
+	   ((uint32)b[2] << 16) | ((uint32)b[3] << 24);
+}
+FF_INLINE void fw_st(void *p, uint32 w) {
+    unsigned char *b = (unsigned char *)p;
+    b[0] = w;
+    b[1] = w >> 8;
+    b[2] = w >> 16;
+    b[3] = w >> 24;
+}
+
+/* Host float from IEEE word, and back
+ */
+FF_INLINE float fw_flt(uint32 w) {
+    float x;
+    memcpy(&x, &w, sizeof (x));
+    return x;
+}
+FF_INLINE uint32 flt_fw(float x) {
+    uint32 w;
+    memcpy(&w, &x, sizeof (w));
+    return w;
+}
+
+#endif
+
+/* Room for a struct fp, for callers that keep it in their own storage
+ * instead of malloc(fp_size()).
+ */
+struct fp_buf {
+    unsigned short w[3];
+};
+
 #endif
@@ -0,0 +1,115 @@
+/* floatfmt.h
+ *
+ * The 32 bit float formats, described as fields of a 32 bit word, and
+ * conversion of a word from one format to another without struct fp.
+ * Host only (z80 would need long arithmetic). floatcnv.c makes its
+ * direct converters (am_ie() etc.) from this, and floatvec.c its
+ * array loops.
+ *
+ * All formats have a 24 bit mantissa, bits 0..23 of the word. The
+ * leading 1 is bit 23 (0.0 if it is 0), or is hidden (0.0 if the
+ * exponent field is 0).
+ */
+
+#ifndef FLOATFMT_H
+#define FLOATFMT_H
+
+#include <stddef.h>
+
+#include "types.h"
+
+struct ff_fmt {
+    int    sbit;    /* sign bit */
+    int    eshift;  /* exponent field is (word >> eshift) & emask */
+    uint32 emask;
+    uint32 esign;   /* not 0: field is 2's complement, with this sign bit */
+    int32  bias;    /* exponent (of 1.m) is field - bias */
+    int    hidden;  /* leading 1 hidden */
+    int    nan;     /* field == emask is NAN or infinity (FP_ERR) */
+    int32  emin;    /* exponents that fit */
+    int32  emax;
+};
+
+/* In the order of FV_IE, FV_MS, FV_HI and FV_AM in floatvec.h. The
+ * ranges are those of fp_ie() fp_ms() fp_hi() fp_am(), which accept
+ * some exponents that wrap (hi 63, am 63) or give a zero field (ms
+ * -129).
+ */
+static const struct ff_fmt ff_fmt[4] = {
+    { 31, 23, 0xff, 0,    127, 1, 1, -126, 127 }, /* ie */
+    { 23, 24, 0xff, 0,    129, 1, 0, -129, 126 }, /* ms */
+    { 31, 24, 0x7f, 0,     65, 0, 0,  -65,  63 }, /* hi */
+    { 31, 24, 0x7f, 0x40,   1, 0, 0,  -64,  63 }  /* am */
+};
+
+#if defined(__GNUC__)
+#define FF_INLINE static __inline__ __attribute__((always_inline))
+#elif defined(__TINYC__)
+#define FF_INLINE static __inline__
+#else
+#define FF_INLINE static
+#endif
+
+
+/* A float taken apart (struct fp, as a value)
+ */
+struct fpval {
+    uint32 mant;    /* 24 bits, leading 1 at bit 23. 0 for 0.0 */
+    int32  exp;     /* value is 1.mant * 2^exp */
+    int    sign;    /* 1 if negative */
+    int    err;     /* was NAN or infinity: FP_ERR, and 0.0 */
+};
+
+
+/* Take apart word w of format f (as ie_fp() and the like)
+ */
+FF_INLINE struct fpval ff_get(const struct ff_fmt *f, uint32 w) {
+    struct fpval v;
+    uint32 fld;
+    int z;
+
+    fld = (w >> f->eshift) & f->emask;
+    v.err = f->nan && (fld == f->emask);
+    z = f->hidden ? (fld == 0) : ((w & 0x800000) == 0);
+    z = z | v.err;
+    if (f->esign)
+	v.exp = (int32)(fld ^ f->esign) - (int32)f->esign - f->bias;
+    else
+	v.exp = (int32)fld - f->bias;
+    v.mant = f->hidden ? ((w & 0x7fffff) | 0x800000) : (w & 0xffffff);
+    v.mant &= (uint32)z - 1;
+    v.sign = (w >> f->sbit) & 1;
+    return v;
+}
+
+
+/* Put together v as a word of format t (as fp_ie() and the like). If
+ * err is not NULL, *err is set to 1 if this is FP_ERR (v.err, or the
+ * exponent does not fit; the word is then 0), else 0.
+ */
+FF_INLINE uint32 ff_put(const struct ff_fmt *t, struct fpval v, int *err) {
+    uint32 r;
+    int z, ok;
+
+    z = (v.mant & 0x800000) == 0;
+    ok = (v.exp >= t->emin) & (v.exp <= t->emax);
+    r = ((uint32)v.sign << t->sbit) |
+	(((uint32)(v.exp + t->bias) & t->emask) << t->eshift) |
+	(t->hidden ? (v.mant & 0x7fffff) : v.mant);
+    if (err != NULL)
+	*err = v.err | (!z & !ok);
+    return (z | !ok) ? 0 : r;
+}
+
+
+/* Convert word w from format f to format t. With f and t constant,
+ * this folds down to a few shifts, masks and compares. (The 0/1 flags
+ * in ff_get() and ff_put() are combined with & and |, not && and ||,
+ * which gcc turns into branches that stop floatvec.c vectorizing.)
+ */
+FF_INLINE uint32 ff_cnv(const struct ff_fmt *t, const struct ff_fmt *f,
+			uint32 w, int *err) {
+    return ff_put(t, ff_get(f, w), err);
+}
+
+#endif
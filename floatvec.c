@@ -0,0 +1,194 @@
+/* floatvec.c
+ *
+ * Floating point conversions on arrays (host only).
+ *
+ * fv_cnv() converts n 4 byte floats from one format to another, with
+ * the same results as the floatcnv.c functions (ie_fp() then fp_am(),
+ * and so on), including FP_ERR: the value is converted to 0.0, and its
+ * bit is set in the error bitmap.
+ *
+ * Each value is converted by ff_cnv() (floatfmt.h), with shifts, masks
+ * and compares instead of branches. This is done in chunks of FV_CHUNK
+ * values, in loops that gcc vectorizes. On x86, the loops are compiled
+ * three times, for plain x86 (SSE2 on x86-64), SSE4.1 and AVX2, and
+ * fv_cnv() picks the best the CPU has on first use. fv_kern() can
+ * force one (for benchmarks).
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "floatfmt.h"
+#include "floatvec.h"
+#include "types.h"
+
+
+#define FV_CHUNK 256
+
+
+#if defined(__GNUC__) && !defined(__TINYC__) && \
+    (defined(__x86_64__) || defined(__i386__))
+#define FV_X86
+#endif
+
+/* Bytes are in the order of floatcnv.c I0..I3 (little endian). A
+ * little endian host can copy them as 32 bit words.
+ */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define FV_LE
+#endif
+
+/* Convert k values at s to d. e[j] is set to 1 for FP_ERR, else 0.
+ * to and from are constant where this is inlined.
+ */
+FF_INLINE void fv_loop(int to, int from, unsigned char *d,
+		       const unsigned char *s, int k, unsigned char *e) {
+    uint32 u[FV_CHUNK];
+    int j, x;
+
+#ifdef FV_LE
+    memcpy(u, s, 4 * k);
+#else
+    for (j = 0; j < k; ++j)
+	u[j] = (uint32)s[4 * j] | ((uint32)s[4 * j + 1] << 8) |
+	       ((uint32)s[4 * j + 2] << 16) | ((uint32)s[4 * j + 3] << 24);
+#endif
+
+    for (j = 0; j < k; ++j) {
+	u[j] = ff_cnv(&ff_fmt[to], &ff_fmt[from], u[j], &x);
+	e[j] = x;
+    }
+
+#ifdef FV_LE
+    memcpy(d, u, 4 * k);
+#else
+    for (j = 0; j < k; ++j) {
+	d[4 * j] = u[j];
+	d[4 * j + 1] = u[j] >> 8;
+	d[4 * j + 2] = u[j] >> 16;
+	d[4 * j + 3] = u[j] >> 24;
+    }
+#endif
+}
+
+
+typedef void fv_fn(unsigned char *, const unsigned char *, int,
+		   unsigned char *);
+
+
+/* One set of the 16 kernels (table index to * 4 + from), named P_tf,
+ * declared with storage class and attributes A
+ */
+#define FV_FN(P, A, t, f) \
+    A void P##_##t##f(unsigned char *d, const unsigned char *s, \
+		      int k, unsigned char *e) { \
+	fv_loop(t, f, d, s, k, e); \
+    }
+
+#define FV_SET(P, A) \
+    FV_FN(P, A, 0, 0) FV_FN(P, A, 0, 1) FV_FN(P, A, 0, 2) FV_FN(P, A, 0, 3) \
+    FV_FN(P, A, 1, 0) FV_FN(P, A, 1, 1) FV_FN(P, A, 1, 2) FV_FN(P, A, 1, 3) \
+    FV_FN(P, A, 2, 0) FV_FN(P, A, 2, 1) FV_FN(P, A, 2, 2) FV_FN(P, A, 2, 3) \
+    FV_FN(P, A, 3, 0) FV_FN(P, A, 3, 1) FV_FN(P, A, 3, 2) FV_FN(P, A, 3, 3) \
+    static fv_fn *P[16] = { \
+	P##_00, P##_01, P##_02, P##_03, P##_10, P##_11, P##_12, P##_13, \
+	P##_20, P##_21, P##_22, P##_23, P##_30, P##_31, P##_32, P##_33 \
+    };
+
+FV_SET(fv_sc, static)
+#ifdef FV_X86
+FV_SET(fv_s4, static __attribute__((target("sse4.1"))))
+FV_SET(fv_a2, static __attribute__((target("avx2"))))
+#endif
+
+
+/* A set of kernels and its name. fv_kern() publishes one with a single
+ * atomic store, so fv_cnv() in another thread sees the whole set or
+ * NULL (and picks one itself).
+ */
+struct fv_ks {
+    fv_fn **tab;
+    const char *name;
+};
+
+static const struct fv_ks fv_ksc = { fv_sc, "scalar" };
+#ifdef FV_X86
+static const struct fv_ks fv_ks4 = { fv_s4, "sse4" };
+static const struct fv_ks fv_ka2 = { fv_a2, "avx2" };
+#endif
+
+static const struct fv_ks *fv_cur = NULL;
+
+
+/* Select kernels by name ("scalar", "sse4" or "avx2"), if the CPU has
+ * them. NULL picks the best. Returns the name of the kernels in use.
+ */
+const char *fv_kern(const char *name) {
+    const struct fv_ks *k = &fv_ksc;
+    const struct fv_ks *c;
+
+#ifdef FV_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.1") &&
+	((name == NULL) || (strcmp(name, "sse4") == 0)))
+	k = &fv_ks4;
+    if (__builtin_cpu_supports("avx2") &&
+	((name == NULL) || (strcmp(name, "avx2") == 0)))
+	k = &fv_ka2;
+#endif
+    if ((name == NULL) || (strcmp(name, k->name) == 0)) {
+	__atomic_store_n(&fv_cur, k, __ATOMIC_RELEASE);
+	return k->name;
+    }
+    c = __atomic_load_n(&fv_cur, __ATOMIC_ACQUIRE);
+    return (c != NULL) ? c->name : fv_kern(NULL);
+}
+
+
+/* Convert n values at src (format from) to dst (format to). dst may be
+ * src. If err is not NULL, it is (n + 7) / 8 bytes, and bit (i & 7) of
+ * err[i >> 3] is set if value i did not fit (FP_ERR). Returns the
+ * number of values that did not fit.
+ */
+size_t fv_cnv(int to, int from, void *dst, const void *src, size_t n,
+	      unsigned char *err) {
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+    unsigned char e[FV_CHUNK + 8];
+    const struct fv_ks *ks;
+    fv_fn *fn;
+    size_t i, bad = 0;
+    int j, k;
+
+    ks = __atomic_load_n(&fv_cur, __ATOMIC_ACQUIRE);
+    if (ks == NULL) {
+	fv_kern(NULL);
+	ks = __atomic_load_n(&fv_cur, __ATOMIC_ACQUIRE);
+    }
+    fn = ks->tab[(to & 3) * 4 + (from & 3)];
+    for (i = 0; i < n; i += k) {
+	k = (n - i < FV_CHUNK) ? (int)(n - i) : FV_CHUNK;
+	(*fn)(d + 4 * i, s + 4 * i, k, e);
+	for (j = 0; j < k; ++j)
+	    bad += e[j];
+	memset(e + k, 0, 8);
+	if (err != NULL)
+	    for (j = 0; j < k; j += 8) {
+#ifdef FV_LE
+		/* 8 bytes of 0 or 1: the multiply moves byte b to bit
+		 * 56 + b, with no carries
+		 */
+		uint64_t q;
+
+		memcpy(&q, e + j, 8);
+		err[(i + j) >> 3] = (q * 0x0102040810204080ULL) >> 56;
+#else
+		err[(i + j) >> 3] = e[j] | (e[j + 1] << 1) | (e[j + 2] << 2) |
+				    (e[j + 3] << 3) | (e[j + 4] << 4) |
+				    (e[j + 5] << 5) | (e[j + 6] << 6) |
+				    (e[j + 7] << 7);
+#endif
+	    }
+    }
+    return bad;
+}
@@ -0,0 +1,23 @@
+/* floatvec.h
+ *
+ * Floating point conversions on arrays (host only). Same results as
+ * the floatcnv.c functions, one value at a time.
+ */
+
+#ifndef FLOATVEC_H
+#define FLOATVEC_H
+
+#include <stddef.h>
+
+/* Formats
+ */
+#define FV_IE 0 /* IEEE 32 bit */
+#define FV_MS 1 /* Microsoft 32 bit */
+#define FV_HI 2 /* Hitech C 32 bit */
+#define FV_AM 3 /* AM9511A 32 bit */
+
+size_t      fv_cnv(int to, int from, void *dst, const void *src, size_t n,
+		   unsigned char *err);
+const char *fv_kern(const char *name);
+
+#endif
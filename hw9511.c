@@ -116,13 +116,18 @@ void am_dump(void *p, unsigned char op) {
 }
 
 
-/* Create AM9511 access structure
+/* Size of AM9511 access structure, for am_init()
  */
-void *am_create(int status, int data) {
-    struct am9511 *p;
-    p = malloc(sizeof (struct am9511));
-    if (p == NULL)
-	return NULL;
+size_t am_size(void) {
+    return sizeof (struct am9511);
+}
+
+
+/* Set up AM9511 access structure in caller's storage
+ */
+void *am_init(void *storage, int status, int data) {
+    struct am9511 *p = (struct am9511 *)storage;
+
     p->status = 0x51;
     p->data = 0x50;
     if (status >= 0)
@@ -131,3 +136,23 @@ void *am_create(int status, int data) {
 	p->data = data;
     return p;
 }
+
+
+/* Create AM9511 access structure
+ */
+void *am_create(int status, int data) {
+    void *p;
+
+    p = malloc(am_size());
+    if (p == NULL)
+	return NULL;
+    return am_init(p, status, data);
+}
+
+
+/* Free AM9511 access structure
+ */
+void am_destroy(void *p) {
+    if (p != NULL)
+	free(p);
+}
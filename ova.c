@@ -22,6 +22,18 @@
 #define USE_MUL16
 
 
+/* On the host (not z80), add and subtract use the gcc overflow
+ * builtins, and multiply uses 64 bit integers. -DOVA_BYTES keeps the
+ * z80 code on the host, to check and time it against these.
+ */
+#if !defined(z80) && !defined(OVA_BYTES)
+#define OVA_MUL64
+#if defined(__GNUC__) && !defined(__TINYC__)
+#define OVA_NATIVE
+#endif
+#endif
+
+
 /* Constant 1, good for 16, 32 and 64 bit
  */
 static unsigned char one[] = { 0x01, 0x00, 0x00, 0x00,
@@ -147,12 +159,16 @@ int add32(unsigned char *pa,
         return carry;
     }
 
-    carry = add16(one, pbh, pch);
-    c2 = add16(pch, pah, pch);
+    /* High halves first, then the carry: pc may be pa or pb, and
+     * pch must not be written before pah and pbh are read
+     */
+    carry = add16(pah, pbh, pch);
+    c2 = add16(pch, one, pch);
     return carry || c2;
 }
 
 
+#ifndef OVA_MUL64
 /* 64 bit add, returns carry. Uses add32().
  *
  * This supports 32x32->64 bit multiply.
@@ -173,10 +189,14 @@ static int add64(unsigned char *pa,
         return carry;
     }
 
-    carry = add32(one, pbh, pch);
-    c2 = add32(pch, pah, pch);
+    /* High halves first, then the carry: pc may be pa or pb, and
+     * pch must not be written before pah and pbh are read
+     */
+    carry = add32(pah, pbh, pch);
+    c2 = add32(pch, one, pch);
     return carry || c2;
 }
+#endif
 
 
 /* 16 bit 2's complement, return 1 if 0x8000
@@ -227,6 +247,7 @@ int cm32(unsigned char *pa,
 }
 
 
+#ifndef OVA_MUL64
 /* 64 bit 2's complement, return 1 if 0x8000 0000 0000 0000
  */
 static int cm64(unsigned char *pa,
@@ -250,6 +271,7 @@ static int cm64(unsigned char *pa,
     add64(pb, one, pb);
     return 0;
 }
+#endif
 
 
 /* 16 bit subtract. Return 1 if carry.
@@ -297,6 +319,145 @@ int sub32(unsigned char *pa,
 }
 
 
+/* SADD DADD SSUB DSUB
+ *
+ * Add or subtract, with carry (borrow) and overflow from the one
+ * operation, returned together as OVA_CARRY and OVA_OVF. pc may be
+ * pa or pb: both operands are loaded before the result is stored.
+ *
+ * add16() and the others followed by oadd16() and the others walk the
+ * operands twice, and with pc == pa (as am9511.c calls them), oadd16()
+ * only sees the result, and never finds overflow.
+ *
+ * With gcc (and clang) these work on whole 16 or 32 bit words, and
+ * the overflow builtins give carry and overflow as flags of the add.
+ * Otherwise (HI-TECH C), overflow is found from the signs.
+ */
+#define LD16(p) ((uint16)((p)[0] | ((p)[1] << 8)))
+#define LD32(p) ((uint32)(p)[0] | ((uint32)(p)[1] << 8) | \
+                 ((uint32)(p)[2] << 16) | ((uint32)(p)[3] << 24))
+#define ST16(p, v) ((p)[0] = (v), (p)[1] = (v) >> 8)
+#define ST32(p, v) ((p)[0] = (v), (p)[1] = (v) >> 8, \
+                    (p)[2] = (v) >> 16, (p)[3] = (v) >> 24)
+
+
+/* SADD, returns OVA_CARRY and OVA_OVF
+ */
+int sadd(unsigned char *pa,
+         unsigned char *pb,
+         unsigned char *pc) {
+    uint16 a, b, c;
+    int s;
+
+    a = LD16(pa);
+    b = LD16(pb);
+#ifdef OVA_NATIVE
+    {
+        int16 v;
+
+        s = __builtin_add_overflow(a, b, &c) ? OVA_CARRY : 0;
+        if (__builtin_add_overflow((int16)a, (int16)b, &v))
+            s |= OVA_OVF;
+    }
+#else
+    c = a + b;
+    s = (c < a) ? OVA_CARRY : 0;
+    if (~(a ^ b) & (a ^ c) & 0x8000)
+        s |= OVA_OVF;
+#endif
+    ST16(pc, c);
+    return s;
+}
+
+
+/* DADD, returns OVA_CARRY and OVA_OVF
+ */
+int dadd(unsigned char *pa,
+         unsigned char *pb,
+         unsigned char *pc) {
+    uint32 a, b, c;
+    int s;
+
+    a = LD32(pa);
+    b = LD32(pb);
+#ifdef OVA_NATIVE
+    {
+        int32 v;
+
+        s = __builtin_add_overflow(a, b, &c) ? OVA_CARRY : 0;
+        if (__builtin_add_overflow((int32)a, (int32)b, &v))
+            s |= OVA_OVF;
+    }
+#else
+    c = a + b;
+    s = (c < a) ? OVA_CARRY : 0;
+    if (~(a ^ b) & (a ^ c) & 0x80000000UL)
+        s |= OVA_OVF;
+#endif
+    ST32(pc, c);
+    return s;
+}
+
+
+/* SSUB (a - b), returns OVA_CARRY (borrow) and OVA_OVF
+ */
+int ssub(unsigned char *pa,
+         unsigned char *pb,
+         unsigned char *pc) {
+    uint16 a, b, c;
+    int s;
+
+    a = LD16(pa);
+    b = LD16(pb);
+#ifdef OVA_NATIVE
+    {
+        int16 v;
+
+        s = __builtin_sub_overflow(a, b, &c) ? OVA_CARRY : 0;
+        if (__builtin_sub_overflow((int16)a, (int16)b, &v))
+            s |= OVA_OVF;
+    }
+#else
+    c = a - b;
+    s = (a < b) ? OVA_CARRY : 0;
+    if ((a ^ b) & (a ^ c) & 0x8000)
+        s |= OVA_OVF;
+#endif
+    ST16(pc, c);
+    return s;
+}
+
+
+/* DSUB (a - b), returns OVA_CARRY (borrow) and OVA_OVF
+ */
+int dsub(unsigned char *pa,
+         unsigned char *pb,
+         unsigned char *pc) {
+    uint32 a, b, c;
+    int s;
+
+    a = LD32(pa);
+    b = LD32(pb);
+#ifdef OVA_NATIVE
+    {
+        int32 v;
+
+        s = __builtin_sub_overflow(a, b, &c) ? OVA_CARRY : 0;
+        if (__builtin_sub_overflow((int32)a, (int32)b, &v))
+            s |= OVA_OVF;
+    }
+#else
+    c = a - b;
+    s = (a < b) ? OVA_CARRY : 0;
+    if ((a ^ b) & (a ^ c) & 0x80000000UL)
+        s |= OVA_OVF;
+#endif
+    ST32(pc, c);
+    return s;
+}
+
+
+#ifndef OVA_MUL64
 /* 16x16 giving 32 bit multiplication
  *
  * We break it down into 8x8 giving 16 bit
@@ -495,6 +656,9 @@ int mulu16(unsigned char *pa,
 }
 
 
+#endif
+
+
 /* 16 bit division.
  *
  * Eventually, I will put my own code in here... but, the objective
@@ -553,6 +717,7 @@ int div32(unsigned char *pa,
 }
 
 
+#ifndef OVA_MUL64
 /* 32x32->64 multiply
  */
 static void mul32(unsigned char *pa,
@@ -687,6 +852,104 @@ int mulu32(unsigned char *pa,
 
     return o;
 }
+#else
+
+/* MUL and MUU on whole words. One signed multiply gives the whole
+ * product, and the results are those of the byte code above (z80),
+ * which multiplies the magnitudes:
+ *
+ *   0x8000 (0x80000000) as an operand gives 0x8000 (0x80000000) and
+ *   overflow. For 32 bit, the check is on a, or on the low half of b
+ *   with the high half of a (so b of 0x80000000 is multiplied).
+ *
+ *   The lower half overflows if the magnitude of the product does
+ *   not fit in 16 (32) bits. The upper half never overflows.
+ */
+#define MIN16(p) (((p)[0] == 0x00) && ((p)[1] == 0x80))
+
+static int min32(unsigned char *pa,
+                 unsigned char *pb,
+                 unsigned char *pc) {
+    if ((pa[2] != 0x00) || (pa[3] != 0x80) ||
+        (((pa[0] | pa[1]) != 0) && ((pb[0] | pb[1]) != 0)))
+        return 0;
+    pc[0] = 0x00;
+    pc[1] = 0x00;
+    pc[2] = 0x00;
+    pc[3] = 0x80;
+    return 1;
+}
+
+
+/* 16 bit multiply, lower. Returns overflow.
+ */
+int mull16(unsigned char *pa,
+           unsigned char *pb,
+           unsigned char *pc) {
+    int32 p;
+    uint32 m;
+
+    if (MIN16(pa) || MIN16(pb)) {
+        pc[0] = 0x00;
+        pc[1] = 0x80;
+        return 1;
+    }
+    p = (int32)(int16)LD16(pa) * (int16)LD16(pb);
+    m = (p < 0) ? 0 - (uint32)p : (uint32)p;
+    ST16(pc, (uint32)p);
+    return m > 0xffff;
+}
+
+
+/* 16 bit multiply, upper. Returns overflow.
+ */
+int mulu16(unsigned char *pa,
+           unsigned char *pb,
+           unsigned char *pc) {
+    int32 p;
+
+    if (MIN16(pa) || MIN16(pb)) {
+        pc[0] = 0x00;
+        pc[1] = 0x80;
+        return 1;
+    }
+    p = (int32)(int16)LD16(pa) * (int16)LD16(pb);
+    ST16(pc, (uint32)p >> 16);
+    return 0;
+}
+
+
+/* 32 bit multiply, lower. Returns overflow.
+ */
+int mull32(unsigned char *pa,
+           unsigned char *pb,
+           unsigned char *pc) {
+    int64_t p;
+    uint64_t m;
+
+    if (min32(pa, pb, pc))
+        return 1;
+    p = (int64_t)(int32)LD32(pa) * (int32)LD32(pb);
+    m = (p < 0) ? 0 - (uint64_t)p : (uint64_t)p;
+    ST32(pc, (uint32)p);
+    return (m >> 32) != 0;
+}
+
+
+/* 32 bit multiply, upper. Returns overflow.
+ */
+int mulu32(unsigned char *pa,
+           unsigned char *pb,
+           unsigned char *pc) {
+    int64_t p;
+
+    if (min32(pa, pb, pc))
+        return 1;
+    p = (int64_t)(int32)LD32(pa) * (int32)LD32(pb);
+    ST32(pc, (uint32)((uint64_t)p >> 32));
+    return 0;
+}
+#endif
 
 
 /*
@@ -23,5 +23,16 @@ int div32(unsigned char *pa, unsigned char *pb, unsigned char *pc);
 int mull32(unsigned char *pa, unsigned char *pb, unsigned char *pc);
 int mulu32(unsigned char *pa, unsigned char *pb, unsigned char *pc);
 
+/* Add and subtract with carry and overflow in one pass, returned as
+ * status bits (the same bits as AM_CARRY and AM_ERR_OVF in am9511.h)
+ */
+#define OVA_CARRY 0x01
+#define OVA_OVF   0x02
+
+int sadd(unsigned char *pa, unsigned char *pb, unsigned char *pc);
+int dadd(unsigned char *pa, unsigned char *pb, unsigned char *pc);
+int ssub(unsigned char *pa, unsigned char *pb, unsigned char *pc);
+int dsub(unsigned char *pa, unsigned char *pb, unsigned char *pc);
+
 #endif
 
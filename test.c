@@ -16,15 +16,15 @@
 #include "types.h"
 
 
-/* Define fp_na() -- fp to native and
- *        na_fp() -- native to fp
+/* Define am_na() -- AM9511 to native and
+ *        na_am() -- native to AM9511
  */
 #ifdef z80
-#define fp_na(x,y) fp_hi(x,y)
-#define na_fp(x,y) hi_fp(x,y)
+#define am_na(x,y) am_hi(x,y)
+#define na_am(x,y) hi_am(x,y)
 #else
-#define fp_na(x,y) fp_ie(x,y)
-#define na_fp(x,y) ie_fp(x,y)
+#define am_na(x,y) am_ie(x,y)
+#define na_am(x,y) ie_am(x,y)
 #endif
 
 
@@ -51,8 +51,6 @@ unsigned char am_wait(void *am9511) {
  * script based test harness in MBASIC instead.
  */
 
-void *fptmp;
-
 #ifdef TEST1
 
 /* TEST1 is NOP, data register push/pop, PUPI, CHSS, CHSD
@@ -112,8 +110,7 @@ void am_test1(void *am9511) {
 
     /* Convert to native floating point
      */
-    am_fp(v, fptmp);
-    fp_na(fptmp, &x);
+    am_na(v, &x);
     printf("PUPI: %g (should be 3.141592)\n", x);
 
     /* Execute CHSS.
@@ -277,8 +274,7 @@ void am_test2(void *am9511) {
     /* Execute CHSF
      */
     x = 3.2;
-    na_fp(&x, fptmp);
-    fp_am(fptmp, v);
+    na_am(&x, v);
     am_push(am9511, v[0]);
     am_push(am9511, v[1]);
     am_push(am9511, v[2]);
@@ -290,13 +286,11 @@ void am_test2(void *am9511) {
     v[2] = am_pop(am9511);
     v[1] = am_pop(am9511);
     v[0] = am_pop(am9511);
-    am_fp(v, fptmp);
-    fp_na(fptmp, &x);
+    am_na(v, &x);
     printf("   result -> %g\n", x);
 
     x = 0.0;
-    na_fp(&x, fptmp);
-    fp_am(fptmp, v);
+    na_am(&x, v);
     am_push(am9511, v[0]);
     am_push(am9511, v[1]);
     am_push(am9511, v[2]);
@@ -308,8 +302,7 @@ void am_test2(void *am9511) {
     v[2] = am_pop(am9511);
     v[1] = am_pop(am9511);
     v[0] = am_pop(am9511);
-    am_fp(v, fptmp);
-    fp_na(fptmp, &x);
+    am_na(v, &x);
     printf("   result -> %g\n", x);
 }
 
@@ -476,8 +469,7 @@ void am_test4(void *am9511) {
     v[2] = am_pop(am9511);
     v[1] = am_pop(am9511);
     v[0] = am_pop(am9511);
-    am_fp(v, fptmp);
-    fp_na(fptmp, &x);
+    am_na(v, &x);
     printf("FADD: 1.0 + 2.0 = %g status = %d\n", x, s);
 
 }
@@ -556,8 +548,7 @@ void am_test5(void *am9511) {
     v[2] = am_pop(am9511);
     v[1] = am_pop(am9511);
     v[0] = am_pop(am9511);
-    am_fp(v, fptmp);
-    fp_na(fptmp, &x);
+    am_na(v, &x);
     printf("FSUB: 1.0 - 2.0 = %g status = %d\n", x, s);
 
     /* DIV: SDIV DDIV FDIV
@@ -618,8 +609,7 @@ void am_test5(void *am9511) {
     v[2] = am_pop(am9511);
     v[1] = am_pop(am9511);
     v[0] = am_pop(am9511);
-    am_fp(v, fptmp);
-    fp_na(fptmp, &x);
+    am_na(v, &x);
     printf("FDIV: 10.0 / 3.0 = %g status = %d\n", x, s);
 }
 
@@ -700,8 +690,7 @@ void am_test6(void *am9511) {
     v[2] = am_pop(am9511);
     v[1] = am_pop(am9511);
     v[0] = am_pop(am9511);
-    am_fp(v, fptmp);
-    fp_na(fptmp, &x);
+    am_na(v, &x);
     printf("FMUL: 10.0 * 3.0 = %g status = %d\n", x, s);
 
     /* MUU */
@@ -1076,12 +1065,6 @@ int main(int ac, char **av) {
     ac -= optind;
     av += optind;
 
-    fptmp = malloc(fp_size());
-    if (fptmp == NULL) {
-	printf("cannot malloc fptmp\n");
-	return 1;
-    }
-
     /* Create AM9511
      */
     am9511 = am_create(s, d);